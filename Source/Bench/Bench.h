@@ -0,0 +1,10 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+
+int benchSpawn(const std::vector<std::string>& args);
+int benchProject(const std::vector<std::string>& args);
+
+#endif /* BENCH_H */
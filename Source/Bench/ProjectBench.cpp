@@ -0,0 +1,304 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: ProjectBench.cpp
+// Purpose: generates synthetic projects and times nmake building them,
+// so regressions in nmake's own overhead show up as numbers.
+//
+//===================================================================//
+
+#include "Bench.h"
+#include "../Build/Scan.h"
+#include "../Config/Config.h"
+#include "../Config/Parser.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct BenchOptions {
+	int files = 200;
+	int depth = 2;
+	int headers = 5;      // includes per source
+	int headerPool = 0;   // distinct headers, 0 = max(16, 2 * headers)
+	int cPercent = 20;
+	int configLines = 3000;
+	int jobs = 0;         // 0 = nmake's default
+	int runs = 3;
+	bool fakeCompiler = false;
+	bool keep = false;
+	std::string dir;
+};
+
+struct Samples {
+	const char* name;
+	std::vector<double> seconds;
+};
+
+// tiny deterministic generator so the same options give the same tree
+struct Lcg {
+	unsigned long long state;
+	unsigned next() {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		return state >> 33;
+	}
+};
+
+double now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string sourceDir(int index, const BenchOptions& opts) {
+	std::string dir = "Source";
+	int n = index;
+	for (int level = 0; level < opts.depth; level++) {
+		dir += "/d" + std::to_string(n % 3);
+		n /= 3;
+	}
+	return dir;
+}
+
+//-----------------------------------------------------------------------------
+// a compiler stand-in that only writes the object (and a depfile listing
+// the generated headers) it was asked for, so timings are nmake's overhead
+// and not gcc's
+//-----------------------------------------------------------------------------
+const char* FAKE_COMPILER =
+	"#!/bin/sh\n"
+	"src= out= dep=\n"
+	"while [ $# -gt 0 ]; do\n"
+	"  case \"$1\" in\n"
+	"    -c|-E) src=$2; shift ;;\n"
+	"    -o) out=$2; shift ;;\n"
+	"    -MF) dep=$2; shift ;;\n"
+	"  esac\n"
+	"  shift\n"
+	"done\n"
+	"[ -n \"$out\" ] && : > \"$out\"\n"
+	"[ -n \"$dep\" ] && echo \"$out: $src\" $(sed -n 's|^#include \"\\(.*\\)\"|Include/\\1|p' \"$src\") > \"$dep\"\n"
+	"exit 0\n";
+
+bool generate(const BenchOptions& opts) {
+	std::filesystem::create_directories(opts.dir + "/Source");
+	std::filesystem::create_directories(opts.dir + "/Include");
+
+	int pool = opts.headerPool > 0 ? opts.headerPool : std::max(16, opts.headers * 2);
+	for (int h = 0; h < pool; h++) {
+		std::string name = "h" + std::to_string(h);
+		std::string text = "#ifndef " + name + "_H\n#define " + name + "_H\n\n";
+		text += "struct " + name + "_t { int a, b, c; };\n";
+		text += "static inline int " + name + "_get(struct " + name + "_t* t) { return t->a + t->b * t->c; }\n\n#endif\n";
+		if (!writeFile(opts.dir + "/Include/" + name + ".h", text)) return false;
+	}
+
+	Lcg rng = {0x6e6d616b65ULL};
+	for (int i = 0; i < opts.files; i++) {
+		bool isC = (int)(rng.next() % 100) < opts.cPercent;
+		std::string text;
+		for (int h = 0; h < std::min(opts.headers, pool); h++)
+			text += "#include \"h" + std::to_string((i + h * 7) % pool) + ".h\"\n";
+		text += "\nint f" + std::to_string(i) + "(int x) {\n\tint y = x;\n";
+		text += "\tfor (int i = 0; i < " + std::to_string(rng.next() % 64 + 1) + "; i++) y = y * 31 + i;\n";
+		text += "\treturn y;\n}\n";
+
+		std::string path = sourceDir(i, opts) + "/f" + std::to_string(i) + (isC ? ".c" : ".cpp");
+		if (!writeFile(opts.dir + "/" + path, text)) return false;
+	}
+	if (!writeFile(opts.dir + "/Source/main.cpp", "int main() { return 0; }\n")) return false;
+
+	std::string config = "Name = \"bench\"\nType = \"Program\"\nCache = false\n";
+	config += "CC_FLAGS = \"-IInclude\"\nCXX_FLAGS = \"-IInclude\"\n";
+	if (opts.fakeCompiler) {
+		std::string fake = opts.dir + "/fakecc";
+		if (!writeFile(fake, FAKE_COMPILER)) return false;
+		chmod(fake.c_str(), 0755);
+		config += "CC = \"./fakecc\"\nCXX = \"./fakecc\"\nLD = \"./fakecc\"\n";
+	}
+	return writeFile(opts.dir + "/config", config);
+}
+
+//-----------------------------------------------------------------------------
+// a config of roughly the requested length, for the parser timings
+//-----------------------------------------------------------------------------
+std::string syntheticConfig(int lines) {
+	std::string text = "# generated by nmake bench\nName = \"bench\"\n";
+	int written = 2;
+	for (int i = 0; written < lines; i++) {
+		if (i % 10 == 9) {
+			text += "step" + std::to_string(i) + "() {\n\trun echo step " + std::to_string(i) + "\n\trun true\n}\n";
+			written += 4;
+		} else {
+			text += "Var" + std::to_string(i) + " = \"value " + std::to_string(i) + " -O2 -Wall\"\n";
+			written++;
+		}
+	}
+	return text;
+}
+
+void touch(const std::string& path) {
+	utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+}
+
+void printSamples(const Samples& s, bool last) {
+	std::vector<double> sorted = s.seconds;
+	std::sort(sorted.begin(), sorted.end());
+	double median = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+	printf("    \"%s\": {\"min\": %.6f, \"median\": %.6f, \"samples\": [", s.name, sorted.empty() ? 0 : sorted[0], median);
+	for (size_t i = 0; i < s.seconds.size(); i++) printf("%s%.6f", i ? ", " : "", s.seconds[i]);
+	printf("]}%s\n", last ? "" : ",");
+}
+
+bool readInt(const std::vector<std::string>& args, size_t& i, int& out) {
+	if (i + 1 >= args.size()) return false;
+	const std::string& v = args[++i];
+	if (v.empty() || v.find_first_not_of("0123456789") != std::string::npos) return false;
+	out = atoi(v.c_str());
+	return true;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// nmake bench project [--files N] [--depth N] [--headers N] [--header-pool N]
+//                     [--c-percent N] [--config-lines N] [--jobs N]
+//                     [--runs N] [--fake-compiler] [--dir DIR] [--keep]
+// prints JSON results on stdout, progress on stderr
+//-----------------------------------------------------------------------------
+int benchProject(const std::vector<std::string>& args) {
+	BenchOptions opts;
+	for (size_t i = 0; i < args.size(); i++) {
+		const std::string& a = args[i];
+		bool ok = true;
+		if (a == "--files") ok = readInt(args, i, opts.files);
+		else if (a == "--depth") ok = readInt(args, i, opts.depth);
+		else if (a == "--headers") ok = readInt(args, i, opts.headers);
+		else if (a == "--header-pool") ok = readInt(args, i, opts.headerPool);
+		else if (a == "--c-percent") ok = readInt(args, i, opts.cPercent);
+		else if (a == "--config-lines") ok = readInt(args, i, opts.configLines);
+		else if (a == "--jobs") ok = readInt(args, i, opts.jobs);
+		else if (a == "--runs") ok = readInt(args, i, opts.runs);
+		else if (a == "--fake-compiler") opts.fakeCompiler = true;
+		else if (a == "--keep") opts.keep = true;
+		else if (a == "--dir" && i + 1 < args.size()) opts.dir = args[++i];
+		else ok = false;
+
+		if (!ok) {
+			fprintf(stderr, "Invalid bench option: %s\n", a.c_str());
+			return 1;
+		}
+	}
+	if (opts.files < 1 || opts.runs < 1 || opts.cPercent > 100) {
+		fprintf(stderr, "Invalid bench options.\n");
+		return 1;
+	}
+
+	char self[4096];
+	ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len < 0) {
+		perror("readlink");
+		return 1;
+	}
+	self[len] = '\0';
+
+	if (opts.dir.empty()) {
+		char tmpl[] = "/tmp/nmake-bench-XXXXXX";
+		if (!mkdtemp(tmpl)) {
+			perror("mkdtemp");
+			return 1;
+		}
+		opts.dir = tmpl;
+	} else if (std::filesystem::exists(opts.dir)) {
+		fprintf(stderr, "%s already exists, not generating over it.\n", opts.dir.c_str());
+		return 1;
+	}
+
+	fprintf(stderr, "Generating %d files in %s...\n", opts.files, opts.dir.c_str());
+	if (!generate(opts)) {
+		fprintf(stderr, "Failed to generate the project.\n");
+		return 1;
+	}
+
+	std::vector<std::string> nmake = {self};
+	if (opts.jobs > 0) nmake.insert(nmake.end(), {"-j", std::to_string(opts.jobs)});
+
+	char cwd[4096];
+	if (!getcwd(cwd, sizeof(cwd)) || chdir(opts.dir.c_str()) != 0) {
+		perror("chdir");
+		return 1;
+	}
+
+	Samples cold = {"cold_build", {}}, noop = {"noop_build", {}}, touchSource = {"touch_source_build", {}};
+	Samples touchHeader = {"touch_header_build", {}}, scan = {"scan", {}}, parse = {"config_parse", {}}, load = {"config_load_cached", {}};
+	bool failed = false;
+
+	auto timeBuild = [&](Samples& s) {
+		double start = now();
+		if (runProcess(nmake, true) != 0) failed = true;
+		s.seconds.push_back(now() - start);
+	};
+
+	std::string base = sourceDir(0, opts) + "/f0.";
+	std::string source = base + (access((base + "c").c_str(), F_OK) == 0 ? "c" : "cpp");
+	for (int r = 0; r < opts.runs && !failed; r++) {
+		fprintf(stderr, "Run %d/%d\n", r + 1, opts.runs);
+		std::filesystem::remove_all("Build");
+		timeBuild(cold);
+		timeBuild(noop);
+		touch(source);
+		timeBuild(touchSource);
+		touch("Include/h0.h");
+		timeBuild(touchHeader);
+
+		double start = now();
+		std::vector<std::string> paths, dirs;
+		scanSources("Source", loadScanRules(""), paths, dirs);
+		scan.seconds.push_back(now() - start);
+	}
+
+	// Parsing is timed in-process, a subprocess would mostly measure exec.
+	std::string text = syntheticConfig(opts.configLines);
+	writeFile("bench.config", text);
+	for (int r = 0; r < opts.runs && !failed; r++) {
+		Config config;
+		std::string error;
+		double start = now();
+		if (!parseConfig(text, config, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			failed = true;
+		}
+		parse.seconds.push_back(now() - start);
+
+		start = now();
+		if (!loadConfig("bench.config", config, error)) failed = true;
+		load.seconds.push_back(now() - start);
+	}
+
+	if (chdir(cwd) != 0) perror("chdir");
+	if (!opts.keep) std::filesystem::remove_all(opts.dir);
+	if (failed) {
+		fprintf(stderr, "A benchmark step failed%s.\n", opts.keep ? "" : ", rerun with --keep to look at the project");
+		return 1;
+	}
+
+	printf("{\n  \"files\": %d,\n  \"depth\": %d,\n  \"headers\": %d,\n  \"c_percent\": %d,\n", opts.files, opts.depth, opts.headers, opts.cPercent);
+	printf("  \"config_lines\": %d,\n  \"jobs\": %d,\n  \"runs\": %d,\n  \"fake_compiler\": %s,\n", opts.configLines, opts.jobs, opts.runs, opts.fakeCompiler ? "true" : "false");
+	printf("  \"results\": {\n");
+	printSamples(cold, false);
+	printSamples(noop, false);
+	printSamples(touchSource, false);
+	printSamples(touchHeader, false);
+	printSamples(scan, false);
+	printSamples(parse, false);
+	printSamples(load, true);
+	printf("  }\n}\n");
+	return 0;
+}
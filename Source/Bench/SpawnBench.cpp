@@ -0,0 +1,56 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: SpawnBench.cpp
+// Purpose: compares system() against runProcess() for trivial jobs.
+//
+//===================================================================//
+
+#include "Bench.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//-----------------------------------------------------------------------------
+// nmake bench spawn [count] [program]
+// runs the program count times each way, one at a time, so the difference
+// is purely per-launch overhead. defaults to /bin/true by path, since a
+// bare "true" is a shell builtin and system() would never exec anything.
+//-----------------------------------------------------------------------------
+int benchSpawn(const std::vector<std::string>& args) {
+	int count = args.size() > 0 ? atoi(args[0].c_str()) : 10000;
+	std::string program = args.size() > 1 ? args[1] : "/bin/true";
+	if (count < 1) {
+		fprintf(stderr, "Invalid job count: %s\n", args[0].c_str());
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		if (system(program.c_str()) != 0) {
+			fprintf(stderr, "system(\"%s\") failed\n", program.c_str());
+			return 1;
+		}
+	}
+	double shell = elapsed(start);
+
+	std::vector<std::string> argv = {program};
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		if (runProcess(argv) != 0) {
+			fprintf(stderr, "runProcess(\"%s\") failed\n", program.c_str());
+			return 1;
+		}
+	}
+	double spawn = elapsed(start);
+
+	printf("%-14s %8d jobs %9.3f s %9.1f us/job\n", "system()", count, shell, shell * 1e6 / count);
+	printf("%-14s %8d jobs %9.3f s %9.1f us/job\n", "posix_spawn", count, spawn, spawn * 1e6 / count);
+	printf("speedup        %.2fx\n", shell / spawn);
+	return 0;
+}
@@ -0,0 +1,939 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Builder.cpp
+// Purpose: compiles and links a project, using the build graph from the
+// last run to skip as much work as possible.
+//
+//===================================================================//
+
+#include "Builder.h"
+#include "Cache.h"
+#include "Compile.h"
+#include "DepFile.h"
+#include "Explain.h"
+#include "Graph.h"
+#include "Pch.h"
+#include "Remote.h"
+#include "Scan.h"
+#include "Scheduler.h"
+#include "Toolchain.h"
+#include "Trace.h"
+#include "Unity.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/HashUtils.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+std::string buildEnvironment() {
+	std::string text;
+	for (const char* env : {"CC", "CXX", "AS", "AR", "PATH"}) text += std::string(env) + "=" + getEnvVar(env) + "\n";
+	return text;
+}
+
+//-----------------------------------------------------------------------------
+// hash of everything outside the tree that decides what the commands look
+// like. if it matches the graph, a build where no file changed is a no-op.
+//-----------------------------------------------------------------------------
+static std::string settingsKey(const Project& project) {
+	Hasher h;
+	h.update("nmake-graph-1");
+	h.update(project.configHash);
+	h.update(buildEnvironment());
+	h.update(readFile(".nmakeignore"));
+	return h.hex();
+}
+
+//-----------------------------------------------------------------------------
+// works out how a source is compiled, false if it isn't one we know
+//-----------------------------------------------------------------------------
+static bool compileStep(const Project& project, const std::string& path, CompileStep& step) {
+	bool depFiles = true;
+	std::string ext = std::filesystem::path(path).extension().string();
+	if (ext == ".cpp" || ext == ".c++" || ext == ".cc" || ext == ".cxx") {
+		step.compiler = project.cxx;
+		step.flags = project.cxxFlags;
+	} else if (ext == ".asm" || ext == ".S") {
+		step.compiler = project.as;
+		step.flags = project.asFlags;
+		depFiles = false;
+	} else if (ext == ".c") {
+		step.compiler = project.cc;
+		step.flags = project.cFlags;
+	} else return false;
+
+	// the object mirrors where the source sits under the source dir
+	std::filesystem::path relative = std::filesystem::path(path).lexically_normal().lexically_relative(std::filesystem::path(project.sourceDir).lexically_normal());
+	if (relative.empty() || *relative.begin() == "..") relative = std::filesystem::path(path).lexically_normal().relative_path();
+	step.source = path;
+	step.object = project.buildDir + "/" + relative.string() + ".o";
+	if (depFiles) step.depFile = step.object + ".d";
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// compiles one object, through the cache and on the workers if given
+//-----------------------------------------------------------------------------
+static int compileObject(CompileCache* cache, WorkerPool* workers, const CompileStep& step, const std::string& identity) {
+	std::filesystem::create_directories(std::filesystem::path(step.object).parent_path());
+	std::filesystem::remove(step.object);
+	if (cache) return cachedCompile(*cache, step, identity, workers);
+	if (workers && !step.depFile.empty()) return distributedCompile(*workers, step);
+	return runProcess(compileArgs(step));
+}
+
+namespace {
+
+// the toolchain some compiler settings resolved to, and what resolving
+// them changed in the project
+struct ResolvedTools {
+	Toolchain toolchain;
+	std::string cc, cxx, as, ld, ldFlags;
+};
+
+// what the configurations built together share: one scan of each source
+// tree, one toolchain lookup per set of compilers, one stat of each source
+// and header, and the compile caches and workers
+struct SharedState {
+	std::map<std::string, std::pair<std::vector<std::string>, std::vector<std::string>>> scans; // source dir and excludes -> sources, dirs
+	std::map<std::string, ResolvedTools> toolchains;
+	std::unordered_map<std::string, FileState> states;
+	std::map<std::string, CompileCache> caches; // by directory
+	std::map<std::string, WorkerPool> pools;    // by endpoints
+
+	FileState state(const std::string& path) {
+		auto it = states.find(path);
+		if (it != states.end()) return it->second;
+		return states[path] = fileState(path);
+	}
+};
+
+enum OutputKind {
+	OUTPUT_PROGRAM,
+	OUTPUT_SHARED,
+	OUTPUT_STATIC,
+};
+
+// something a build links its objects into
+struct Output {
+	OutputKind kind;
+	std::string path;
+	uint32_t node = 0;
+	int job = -1; // in links, if it's out of date
+};
+
+// one project, or one configuration of it, through a build: plan() works
+// out its compile jobs, finishCompiles() records what they did and sets up
+// the links, finishLinks() saves the graph
+class ProjectBuild {
+public:
+	ProjectBuild(Project& project, const std::vector<Output>& outputs, const std::string& label, const BuildOptions& options, BuildGraph* previous, SharedState& shared);
+
+	int plan();
+	int finishCompiles();
+	int finishLinks(const Job* done);
+
+	std::vector<Job> jobs;
+	std::vector<Job> links;
+
+private:
+	FileState stateOf(const std::string& path);
+	std::string profileOf(const CompileStep& step) const;
+	void addInputs(GraphTarget& target, const CompileStep& step);
+	void planLink(Output& output, const std::vector<std::string>& objects, std::unordered_map<std::string, std::string>& objectHashes);
+	void planArchive(Output& output, const std::vector<std::string>& objects, std::unordered_map<std::string, std::string>& objectHashes);
+	void saveGraph();
+	void nothingToDo() const;
+
+	Project& project;
+	std::vector<Output> outputs;
+	const BuildOptions& options;
+	BuildGraph* previous;
+	SharedState& shared;
+	std::string suffix; // after job descriptions, names the configuration or flavour
+
+	std::string stateDir, graphPath;
+	BuildGraph loaded;
+	bool inMemory;
+	BuildGraph& old;
+	std::vector<FileState> current;
+	bool sameSettings = false;
+	BuildGraph graph;
+
+	std::vector<uint32_t> pchInputs;
+	std::vector<CompileUnit> units;
+	std::vector<GraphTarget> targets;
+	std::vector<size_t> jobUnit, jobTarget;
+	std::vector<char> fellBack;
+};
+
+ProjectBuild::ProjectBuild(Project& project, const std::vector<Output>& outputs, const std::string& label, const BuildOptions& options, BuildGraph* previous, SharedState& shared)
+	: project(project), outputs(outputs), options(options), previous(previous), shared(shared),
+	  stateDir(project.buildDir + "/.nmake"), graphPath(stateDir + "/graph"),
+	  inMemory(previous && !previous->nodes.empty()), old(inMemory ? *previous : loaded) {
+	if (!label.empty()) suffix = " (" + label + ")";
+}
+
+FileState ProjectBuild::stateOf(const std::string& path) {
+	int i = old.findNode(path);
+	return i >= 0 ? current[i] : shared.state(path);
+}
+
+void ProjectBuild::nothingToDo() const {
+	std::string names;
+	for (size_t i = 0; i < outputs.size(); i++) names += (i == 0 ? "'" : "' and '") + outputs[i].path;
+	std::cout << "Nothing to be done, " << names << (outputs.size() == 1 ? "' is" : "' are") << " up to date." << std::endl;
+}
+
+// Past this point the old graph isn't needed once the new one is saved.
+void ProjectBuild::saveGraph() {
+	graph.save(graphPath);
+	if (previous) {
+		graph.reindex();
+		*previous = std::move(graph);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// the profile an optimized object reads, empty if it doesn't. gcc reads
+// the .gcda named after the object, clang the one merged profile.
+//-----------------------------------------------------------------------------
+std::string ProjectBuild::profileOf(const CompileStep& step) const {
+	if (project.profileMode != PROFILE_USE || step.depFile.empty()) return "";
+	if (!project.profile.empty()) return project.profile;
+	return step.object.substr(0, step.object.size() - 2) + ".gcda";
+}
+
+void ProjectBuild::addInputs(GraphTarget& target, const CompileStep& step) {
+	if (step.depFile.empty()) return;
+	if (isCxxSource(step.source)) target.inputs.insert(target.inputs.end(), pchInputs.begin(), pchInputs.end());
+	std::string profile = profileOf(step);
+	if (!profile.empty()) {
+		uint32_t n = graph.addNode(profile, NODE_HEADER);
+		graph.nodes[n].state = stateOf(profile);
+		target.inputs.push_back(n);
+	}
+	std::vector<std::string> deps;
+	parseDepFile(readFile(step.depFile), deps);
+	for (const auto& dep : deps) {
+		if (dep == step.source) continue;
+		uint32_t n = graph.addNode(dep, NODE_HEADER);
+		if (graph.nodes[n].state.mtime < 0) graph.nodes[n].state = stateOf(dep);
+		target.inputs.push_back(n);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// -1 if the jobs need running, else the build is over and this is its
+// exit status
+//-----------------------------------------------------------------------------
+int ProjectBuild::plan() {
+	TracePhase loadPhase("load build graph");
+	std::string error;
+	if (!inMemory && !old.load(graphPath, error) && !error.empty())
+		std::cerr << "nmake: ignoring corrupt build graph (" << error << "), it will be rebuilt" << std::endl;
+	loadPhase.end();
+
+	TracePhase checkPhase("check build graph");
+
+	// Stat everything the last build looked at, once. Sources and headers
+	// other configurations read are only stat'ed once between them.
+	std::string key = settingsKey(project);
+	sameSettings = !options.alwaysMake && !old.nodes.empty() && old.key == key;
+	bool dirsChanged = false, anyChanged = false;
+	current.resize(old.nodes.size());
+	for (size_t i = 0; i < old.nodes.size(); i++) {
+		NodeKind kind = old.nodes[i].kind;
+		bool tree = kind == NODE_DIR || kind == NODE_SOURCE || kind == NODE_HEADER;
+		current[i] = tree ? shared.state(old.nodes[i].path) : fileState(old.nodes[i].path);
+		if (current[i] != old.nodes[i].state) {
+			anyChanged = true;
+			if (kind == NODE_DIR) dirsChanged = true;
+		}
+	}
+
+	checkPhase.end();
+
+	if (sameSettings && !anyChanged) {
+		if (previous && !inMemory) *previous = std::move(loaded);
+		nothingToDo();
+		return 0;
+	}
+
+	TracePhase resolvePhase("resolve compilers");
+	std::string tools = project.cc + "\n" + project.cxx + "\n" + project.as + "\n" + project.ld + "\n" + project.ldFlags;
+	auto resolved = shared.toolchains.find(tools);
+	if (resolved == shared.toolchains.end()) {
+		ResolvedTools result;
+		if (!resolveToolchain(project, result.toolchain)) return 1;
+		result.cc = project.cc;
+		result.cxx = project.cxx;
+		result.as = project.as;
+		result.ld = project.ld;
+		result.ldFlags = project.ldFlags;
+		resolved = shared.toolchains.emplace(tools, result).first;
+	}
+	const Toolchain& toolchain = resolved->second.toolchain;
+	project.cc = resolved->second.cc;
+	project.cxx = resolved->second.cxx;
+	project.as = resolved->second.as;
+	project.ld = resolved->second.ld;
+	project.ldFlags = resolved->second.ldFlags;
+
+	resolvePhase.end();
+
+	// Link time optimization, split across jobs the way each compiler does
+	// it, when every tool took the flag.
+	if (project.lto) {
+		if (toolchain.cc.accepts(ltoFlag(toolchain.cc)) && toolchain.cxx.accepts(ltoFlag(toolchain.cxx)) && toolchain.ld.accepts(ltoFlag(toolchain.ld))) {
+			project.cFlags += " " + ltoFlag(toolchain.cc);
+			project.cxxFlags += " " + ltoFlag(toolchain.cxx);
+			project.ldFlags += " " + ltoFlag(toolchain.ld);
+		} else {
+			std::cerr << "nmake: the compilers or linker don't support LTO, building without it" << std::endl;
+		}
+	}
+
+	graph.key = key;
+
+	// Directory mtimes only change when entries are added or removed, so if
+	// none did the source list from last time is still right.
+	TracePhase scanPhase("scan sources");
+	std::vector<std::string> paths, dirs;
+	if (sameSettings && !dirsChanged) {
+		for (const auto& node : old.nodes) {
+			if (node.kind == NODE_DIR) dirs.push_back(node.path);
+			else if (node.kind == NODE_SOURCE) paths.push_back(node.path);
+		}
+	} else {
+		std::string scanKey = project.sourceDir + "\n" + project.exclude;
+		auto scan = shared.scans.find(scanKey);
+		if (scan == shared.scans.end()) {
+			scan = shared.scans.emplace(scanKey, std::make_pair(std::vector<std::string>(), std::vector<std::string>())).first;
+			scanSources(project.sourceDir, loadScanRules(project.exclude), scan->second.first, scan->second.second);
+		}
+		paths = scan->second.first;
+		dirs = scan->second.second;
+	}
+	for (const auto& dir : dirs) graph.nodes[graph.addNode(dir, NODE_DIR)].state = stateOf(dir);
+	scanPhase.end();
+
+	// The precompiled header is built before anything that uses it. Compiles
+	// that use it don't list what's in it in their depfiles, so its inputs
+	// are added to every C++ target by hand.
+	if (!project.pch.empty() && !toolchain.cxx.accepts(pchFlag()))
+		std::cerr << "nmake: '" << project.cxx << "' can't precompile headers, building without PCH" << std::endl;
+	if (!project.pch.empty() && toolchain.cxx.accepts(pchFlag())) {
+		TracePhase pchPhase("precompiled header");
+		PrecompiledHeader pch;
+		if (setupPch(project, toolchain.cxx, paths, stateDir, pch)) {
+			if (options.alwaysMake || dependenciesChanged(pch.step.object, pch.step.depFile)) {
+				std::filesystem::remove(pch.step.object);
+				std::vector<Job> pchJobs = {{"Precompiling '" + pch.header + "'" + suffix, compileArgs(pch.step)}};
+				if (!runJobs(pchJobs, 1, false)) {
+					std::cerr << "Build failed." << std::endl;
+					return 1;
+				}
+			}
+
+			std::vector<std::string> deps;
+			parseDepFile(readFile(pch.step.depFile), deps);
+			deps.push_back(pch.step.object);
+			for (const auto& dep : deps) {
+				uint32_t n = graph.addNode(dep, NODE_HEADER);
+				graph.nodes[n].state = fileState(dep);
+				pchInputs.push_back(n);
+				// It may have just been rebuilt, so what we stat'ed earlier is stale.
+				int o = old.findNode(dep);
+				if (o >= 0) current[o] = graph.nodes[n].state;
+			}
+			project.cxxFlags += " " + pchFlags(pch);
+		}
+	}
+
+	// Instrumented objects have where they write their profile built in,
+	// and the cache key doesn't cover the profile optimized ones read, so
+	// both are only compiled here.
+	bool profiling = project.profileMode != PROFILE_NONE;
+	CompileCache* cache = nullptr;
+	if (project.useCache && !profiling) {
+		std::string dir = project.cacheDir.empty() ? defaultCacheDir() : project.cacheDir;
+		cache = &shared.caches[dir];
+		cache->dir = dir;
+		cache->maxSize = project.cacheSize;
+	}
+
+	// Compiler identities are part of the cache key.
+	std::map<std::string, std::string> identities;
+	identities[project.cc] = toolchain.cc.identity();
+	identities[project.cxx] = toolchain.cxx.identity();
+
+	// C and C++ are preprocessed here and compiled on the workers, if there
+	// are any. They only take compiles for the same compiler version.
+	std::string endpoints = project.workers.empty() ? getEnvVar("NMAKE_WORKERS") : project.workers;
+	std::replace(endpoints.begin(), endpoints.end(), ',', ' ');
+	WorkerPool* workers = nullptr;
+	if (!splitArgs(endpoints).empty() && !profiling) {
+		workers = &shared.pools[endpoints];
+		workers->endpoints = splitArgs(endpoints);
+		workers->toolchains[project.cc] = toolchain.cc.version + "\n" + toolchain.cc.target;
+		workers->toolchains[project.cxx] = toolchain.cxx.version + "\n" + toolchain.cxx.target;
+	}
+
+	TracePhase planPhase("plan compiles");
+	std::vector<CompileStep> sources;
+	for (const auto& path : paths) {
+		CompileStep step;
+		if (!compileStep(project, path, step)) continue;
+		graph.nodes[graph.addNode(path, NODE_SOURCE)].state = stateOf(path);
+		sources.push_back(step);
+	}
+
+	if (project.unity) {
+		for (auto& unit : unityBatches(sources, project.buildDir, project.unityBatch)) {
+			// A batch that failed last time was built file by file, keep
+			// doing that until what's in it changes.
+			bool split = sameSettings && !unit.members.empty() && !unit.changed;
+			int oldBatch = old.findNode(unit.step.object);
+			if (split) split = oldBatch < 0 || old.findTarget(oldBatch) < 0;
+			for (const auto& member : unit.members) {
+				int n = split ? old.findNode(member.object) : -1;
+				split = n >= 0 && old.findTarget(n) >= 0;
+			}
+
+			if (split) {
+				for (const auto& member : unit.members) units.push_back({member});
+			} else {
+				units.push_back(unit);
+			}
+		}
+	} else {
+		for (const auto& step : sources) units.push_back({step});
+	}
+
+	fellBack.assign(units.size(), 0);
+	for (size_t u = 0; u < units.size(); u++) {
+		const CompileUnit& unit = units[u];
+		const CompileStep& step = unit.step;
+		const std::string& path = step.source;
+		bool depFiles = !step.depFile.empty();
+
+		GraphTarget target;
+		target.source = graph.addNode(path, unit.members.empty() ? NODE_SOURCE : NODE_UNITY);
+		target.object = graph.addNode(step.object, NODE_OBJECT);
+		target.commandHash = hashString(compileCommand(step));
+		target.command = commandTemplate(step);
+		graph.nodes[target.source].state = unit.changed ? fileState(path) : stateOf(path);
+
+		// An object the graph knows about is stale if it, its source,
+		// anything it read or the command that built it changed. Reasons are
+		// kept for nmake explain.
+		std::string reason = options.alwaysMake ? "-B was given" : "";
+		int oldObject = old.findNode(step.object);
+		int oldTarget = oldObject >= 0 ? old.findTarget(oldObject) : -1;
+		if (reason.empty() && oldTarget >= 0 && old.nodes[old.targets[oldTarget].source].path == path) {
+			const GraphTarget& prev = old.targets[oldTarget];
+			if (current[prev.object] != old.nodes[prev.object].state) {
+				reason = "'" + step.object + "' was changed or deleted";
+			} else if (current[prev.source] != old.nodes[prev.source].state || graph.nodes[target.source].state != old.nodes[prev.source].state) {
+				reason = unit.members.empty() ? "'" + path + "' changed" : "the files in its unity batch changed";
+			} else if (prev.commandHash != target.commandHash) {
+				reason = describeCommandChange(prev.command, target.command);
+			}
+			for (uint32_t input : prev.inputs) {
+				if (!reason.empty()) break;
+				if (current[input] != old.nodes[input].state) reason = "'" + old.nodes[input].path + "' changed";
+			}
+			if (reason.empty()) {
+				for (uint32_t input : prev.inputs) {
+					uint32_t n = graph.addNode(old.nodes[input].path, NODE_HEADER);
+					graph.nodes[n].state = current[input];
+					target.inputs.push_back(n);
+				}
+				target.reason = prev.reason;
+				target.durationMs = prev.durationMs;
+				target.peakRssKb = prev.peakRssKb;
+			}
+		} else if (reason.empty() && fileState(step.object).mtime < 0) {
+			reason = "it hadn't been built before";
+		} else if (reason.empty() && !old.nodes.empty()) {
+			// Whatever left this object behind, nothing says it was built with
+			// this command.
+			reason = "the build graph had no record of how it was built";
+		} else if (reason.empty()) {
+			// Without a graph there's only the depfile to go by.
+			bool stale = depFiles ? dependenciesChanged(step.object, step.depFile) : isOutOfDate(step.object, path);
+			bool usesPch = !pchInputs.empty() && isCxxSource(path);
+			if (!stale && usesPch) stale = isOutOfDate(step.object, graph.nodes[pchInputs.back()].path);
+			std::string profile = profileOf(step);
+			if (!stale && !profile.empty()) stale = isOutOfDate(step.object, profile);
+			if (stale) reason = "there was no build graph and it was older than its source or a header";
+			if (!stale && depFiles) {
+				std::vector<std::string> deps;
+				parseDepFile(readFile(step.depFile), deps);
+				for (const auto& dep : deps) {
+					if (dep == path) continue;
+					uint32_t n = graph.addNode(dep, NODE_HEADER);
+					graph.nodes[n].state = stateOf(dep);
+					target.inputs.push_back(n);
+				}
+				if (usesPch) target.inputs.insert(target.inputs.end(), pchInputs.begin(), pchInputs.end());
+				if (!profile.empty()) {
+					uint32_t n = graph.addNode(profile, NODE_HEADER);
+					graph.nodes[n].state = stateOf(profile);
+					target.inputs.push_back(n);
+				}
+			}
+		}
+
+		if (reason.empty()) {
+			graph.nodes[target.object].state = stateOf(step.object);
+			targets.push_back(target);
+			continue;
+		}
+		target.reason = reason;
+
+		Job job = {"Compiling '" + path + "'" + suffix, compileArgs(step)};
+		// The scheduler starts files that took long last time first, and keeps
+		// ones that took a lot of memory from running alongside each other
+		// past what's free.
+		if (oldTarget >= 0) target.peakRssKb = old.targets[oldTarget].peakRssKb;
+		job.memory = (unsigned long long)target.peakRssKb << 10;
+		if (oldTarget >= 0) job.expected = old.targets[oldTarget].durationMs / 1000.0;
+		// Only C and C++ go through the cache, the assemblers can't preprocess.
+		CompileCache* useCache = depFiles ? cache : nullptr;
+		std::string identity = identities[step.compiler];
+		if (!unit.members.empty()) {
+			job.description = "Compiling " + std::to_string(unit.members.size()) + " files in '" + path + "'" + suffix;
+			std::vector<CompileStep> members = unit.members;
+			char* failed = &fellBack[u];
+			// If the batch doesn't compile (two files defining the same static,
+			// say) its files are compiled on their own instead.
+			job.run = [useCache, workers, step, members, identity, failed]() {
+				int status = compileObject(useCache, workers, step, identity);
+				if (status == 0) return 0;
+				printOutput("nmake: unity batch '" + step.source + "' failed, compiling its files separately\n");
+				*failed = 1;
+				for (const auto& member : members) {
+					if ((status = compileObject(useCache, workers, member, identity)) != 0) return status;
+				}
+				return 0;
+			};
+		} else if (useCache) {
+			job.run = [useCache, workers, step, identity]() { return cachedCompile(*useCache, step, identity, workers); };
+		} else if (workers && depFiles) {
+			job.run = [workers, step]() { return distributedCompile(*workers, step); };
+		}
+
+		std::filesystem::create_directories(std::filesystem::path(step.object).parent_path());
+		// Objects restored from the cache are read-only hard links, the
+		// compiler has to write a new file rather than through the old one.
+		std::filesystem::remove(step.object);
+		jobs.push_back(job);
+		jobUnit.push_back(u);
+		jobTarget.push_back(targets.size());
+		targets.push_back(target);
+	}
+
+	planPhase.end();
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// once the compile jobs ran: -1 if link is the job that links the
+// project, else the build is over and this is its exit status
+//-----------------------------------------------------------------------------
+int ProjectBuild::finishCompiles() {
+	bool compiled = true;
+	for (const auto& job : jobs) compiled = compiled && job.started && job.status == 0;
+
+	// Pick up what the compiler read for everything that was rebuilt. A
+	// failed object is left out of the graph so it's retried next time, and
+	// a batch that fell back is replaced by its files.
+	std::vector<bool> keep(targets.size(), true);
+	for (size_t j = 0; j < jobs.size(); j++) {
+		GraphTarget& target = targets[jobTarget[j]];
+		const CompileUnit& unit = units[jobUnit[j]];
+		if (!jobs[j].started || jobs[j].status != 0 || fellBack[jobUnit[j]]) {
+			keep[jobTarget[j]] = false;
+			if (!fellBack[jobUnit[j]] || jobs[j].status != 0) continue;
+
+			for (const auto& member : unit.members) {
+				GraphTarget t;
+				t.source = graph.addNode(member.source, NODE_SOURCE);
+				t.object = graph.addNode(member.object, NODE_OBJECT);
+				t.commandHash = hashString(compileCommand(member));
+				t.command = commandTemplate(member);
+				t.reason = "its unity batch '" + unit.step.source + "' didn't compile";
+				graph.nodes[t.object].state = fileState(member.object);
+				addInputs(t, member);
+				graph.targets.push_back(t);
+			}
+			continue;
+		}
+
+		target.durationMs = jobs[j].seconds * 1000;
+		// A cache hit only runs the preprocessor, one small reading shouldn't
+		// wipe out what a real compile of the file needed.
+		uint32_t peakKb = jobs[j].peakRss >> 10;
+		target.peakRssKb = std::max(peakKb, target.peakRssKb - target.peakRssKb / 4);
+		graph.nodes[target.object].state = fileState(unit.step.object);
+		addInputs(target, unit.step);
+	}
+	for (size_t i = 0; i < targets.size(); i++) {
+		if (keep[i]) graph.targets.push_back(targets[i]);
+	}
+
+	std::vector<std::string> objects;
+	for (size_t u = 0; u < units.size(); u++) {
+		if (!fellBack[u]) objects.push_back(units[u].step.object);
+		else for (const auto& member : units[u].members) objects.push_back(member.object);
+	}
+
+	std::filesystem::create_directories(stateDir);
+	for (auto& output : outputs) output.node = graph.addNode(output.path, NODE_OUTPUT);
+
+	if (!compiled) {
+		// No key, so the next run can't take the no-op shortcut.
+		graph.key.clear();
+		saveGraph();
+		return 1;
+	}
+
+	// The link only depends on the command and what's in the objects, so a
+	// rebuilt object that came out the same doesn't relink. Objects are only
+	// rehashed when they changed since the last build.
+	TracePhase hashPhase("hash objects");
+	std::unordered_map<std::string, std::string> objectHashes;
+	for (auto& target : graph.targets) {
+		const GraphNode& node = graph.nodes[target.object];
+		int o = old.findNode(node.path);
+		int t = o >= 0 ? old.findTarget(o) : -1;
+		if (t >= 0 && !old.targets[t].objectHash.empty() && old.nodes[o].state == node.state) {
+			target.objectHash = old.targets[t].objectHash;
+		} else {
+			Hasher h;
+			if (hashFile(node.path, h)) target.objectHash = h.hex();
+		}
+		objectHashes[node.path] = target.objectHash;
+	}
+	hashPhase.end();
+
+	for (auto& output : outputs) {
+		if (output.kind == OUTPUT_STATIC) planArchive(output, objects, objectHashes);
+		else planLink(output, objects, objectHashes);
+	}
+
+	if (links.empty()) {
+		saveGraph();
+		nothingToDo();
+		return 0;
+	}
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// a program or shared library is relinked only if the command or an
+// object's contents changed since the last link, or it went missing
+//-----------------------------------------------------------------------------
+void ProjectBuild::planLink(Output& output, const std::vector<std::string>& objects, std::unordered_map<std::string, std::string>& objectHashes) {
+	std::string flags = project.ldFlags;
+	if (output.kind == OUTPUT_SHARED) flags = "-shared" + (flags.empty() ? "" : " " + flags);
+	std::vector<std::string> link_args = linkArgs(project.ld, flags, output.path, objects);
+	std::string link_command = joinArgs(link_args);
+
+	Hasher linkInputs;
+	linkInputs.update(link_command);
+	for (const auto& object : objects) linkInputs.update(objectHashes[object]);
+	graph.linkHash = linkInputs.hex();
+
+	int oldOutput = old.findNode(output.path);
+	bool relink = options.alwaysMake || old.linkHash != graph.linkHash || oldOutput < 0 || current[oldOutput] != old.nodes[oldOutput].state;
+	if (!relink) {
+		graph.nodes[output.node].state = current[oldOutput];
+		return;
+	}
+
+	// The command is shown when the link runs, not here: a failed compile
+	// means it never does.
+	Job job = {"Linking '" + output.path + "'", link_args};
+	job.category = "link";
+	job.run = [link_args, link_command]() {
+		printOutput("Linking: " + link_command + "\n");
+		return runProcess(link_args);
+	};
+	output.job = links.size();
+	links.push_back(job);
+}
+
+//-----------------------------------------------------------------------------
+// what an object is called in a static library: its path in the build
+// directory with '/' escaped. ar only matches members by file name, so
+// objects with the same name in different directories would replace each
+// other otherwise.
+//-----------------------------------------------------------------------------
+static std::string memberName(const std::string& object, const std::string& buildDir) {
+	std::filesystem::path relative = std::filesystem::path(object).lexically_normal().lexically_relative(std::filesystem::path(buildDir).lexically_normal());
+	std::string name;
+	for (char c : relative.string()) {
+		if (c == '%') name += "%25";
+		else if (c == '/') name += "%2F";
+		else name += c;
+	}
+	return name;
+}
+
+//-----------------------------------------------------------------------------
+// a static library is updated in place: members whose object changed are
+// replaced and ones whose source went away are deleted. objects go in
+// through hard links named by memberName() in .nmake/archive. it's
+// written anew when it isn't the one the last build left, or the settings
+// changed.
+//-----------------------------------------------------------------------------
+void ProjectBuild::planArchive(Output& output, const std::vector<std::string>& objects, std::unordered_map<std::string, std::string>& objectHashes) {
+	std::string ar = project.ar.empty() ? getEnvVar("AR") : project.ar;
+	std::vector<std::string> arArgs = splitArgs(ar.empty() ? "ar" : ar);
+
+	Hasher archiveInputs;
+	archiveInputs.update(joinArgs(arArgs));
+	for (const auto& object : objects) {
+		archiveInputs.update(object);
+		archiveInputs.update(objectHashes[object]);
+	}
+	graph.archiveHash = archiveInputs.hex();
+
+	int oldArchive = old.findNode(output.path);
+	bool intact = sameSettings && !old.archiveHash.empty() && oldArchive >= 0 && current[oldArchive] == old.nodes[oldArchive].state;
+	if (intact && old.archiveHash == graph.archiveHash) {
+		graph.nodes[output.node].state = current[oldArchive];
+		return;
+	}
+
+	std::vector<std::string> replace, remove;
+	if (!intact) {
+		replace = objects;
+	} else {
+		std::unordered_map<std::string, bool> members;
+		for (const auto& object : objects) members[object] = true;
+		for (const auto& target : old.targets) {
+			const std::string& path = old.nodes[target.object].path;
+			if (!members.count(path)) remove.push_back(path);
+		}
+		for (const auto& object : objects) {
+			int o = old.findNode(object);
+			int t = o >= 0 ? old.findTarget(o) : -1;
+			if (t < 0 || old.targets[t].objectHash != objectHashes[object]) replace.push_back(object);
+		}
+	}
+
+	std::string memberDir = stateDir + "/archive";
+	std::vector<std::pair<std::string, std::string>> links; // object, member
+	std::vector<std::string> removed;
+	for (const auto& object : replace) links.push_back({object, memberDir + "/" + memberName(object, project.buildDir)});
+	for (const auto& object : remove) removed.push_back(memberDir + "/" + memberName(object, project.buildDir));
+
+	std::vector<std::vector<std::string>> commands;
+	auto command = [&](const char* op, const std::vector<std::string>& members) {
+		std::vector<std::string> args = arArgs;
+		args.push_back(op);
+		args.push_back(output.path);
+		args.insert(args.end(), members.begin(), members.end());
+		commands.push_back(args);
+	};
+	if (!removed.empty()) command(links.empty() ? "ds" : "d", removed);
+	if (!links.empty()) {
+		std::vector<std::string> members;
+		for (const auto& link : links) members.push_back(link.second);
+		command("rcs", members);
+	}
+
+	std::string description;
+	for (const auto& args : commands) description += (description.empty() ? "" : " && ") + joinArgs(args);
+
+	std::string path = output.path;
+	Job job = {"Archiving '" + path + "'", commands.back()};
+	job.category = "link";
+	job.command = description;
+	job.run = [path, intact, memberDir, links, removed, commands, description]() {
+		printOutput("Archiving: " + description + "\n");
+		std::error_code ec;
+		if (!intact) {
+			std::filesystem::remove(path, ec);
+			std::filesystem::remove_all(memberDir, ec);
+		}
+		std::filesystem::create_directories(memberDir, ec);
+		for (const auto& link : links) {
+			std::filesystem::remove(link.second, ec);
+			std::filesystem::create_hard_link(link.first, link.second, ec);
+			if (ec) std::filesystem::copy_file(link.first, link.second, ec);
+			if (ec) {
+				printOutput("nmake: can't add '" + link.first + "' to the archive: " + ec.message() + "\n");
+				return 1 << 8;
+			}
+		}
+		for (const auto& args : commands) {
+			int status = runProcess(args);
+			if (status != 0) return status;
+		}
+		for (const auto& member : removed) std::filesystem::remove(member, ec);
+		return 0;
+	};
+	output.job = this->links.size();
+	this->links.push_back(job);
+}
+
+//-----------------------------------------------------------------------------
+// the exit status, once the link jobs ran (or didn't, when another build's
+// compiles failed). done holds them, in the order of links.
+//-----------------------------------------------------------------------------
+int ProjectBuild::finishLinks(const Job* done) {
+	bool failed = false, ran = true;
+	for (auto& output : outputs) {
+		if (output.job < 0) continue;
+		const Job& job = done[output.job];
+		if (job.started && job.status == 0) {
+			graph.nodes[output.node].state = fileState(output.path);
+			continue;
+		}
+		// No key, so whatever is left of a half updated archive is written anew.
+		graph.key.clear();
+		if (output.kind == OUTPUT_STATIC) graph.archiveHash.clear();
+		else graph.linkHash.clear();
+		failed = true;
+		ran = ran && job.started;
+	}
+	saveGraph();
+	if (failed && ran) std::cerr << "Linking failed." << std::endl;
+	return failed ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+// plans every build, runs all their compiles through one scheduler, then
+// all the links that are needed
+//-----------------------------------------------------------------------------
+int runBuilds(std::vector<std::unique_ptr<ProjectBuild>>& builds, const BuildOptions& options, SharedState& shared) {
+	int result = 0;
+	std::vector<ProjectBuild*> active;
+	for (auto& b : builds) {
+		int status = b->plan();
+		if (status < 0) active.push_back(b.get());
+		else if (status != 0 && !options.keepGoing) return status;
+		else result = std::max(result, status);
+	}
+
+	// Objects all have to exist before we can link.
+	std::vector<Job> jobs;
+	for (auto b : active) jobs.insert(jobs.end(), b->jobs.begin(), b->jobs.end());
+	TracePhase compilePhase("compile");
+	runJobs(jobs, options.jobs, options.keepGoing, options.maxLoad);
+	compilePhase.end();
+	if (options.explainSchedule) explainSchedule(jobs, options.jobs);
+	size_t offset = 0;
+	for (auto b : active) {
+		std::copy(jobs.begin() + offset, jobs.begin() + offset + b->jobs.size(), b->jobs.begin());
+		offset += b->jobs.size();
+	}
+	for (auto& cache : shared.caches) finishCache(cache.second);
+	for (auto& pool : shared.pools) {
+		if (pool.second.remote > 0 || pool.second.local > 0)
+			std::cout << "Compiled " << pool.second.remote << " of " << pool.second.remote + pool.second.local << " objects on workers." << std::endl;
+	}
+
+	std::vector<ProjectBuild*> linking;
+	std::vector<Job> links;
+	std::vector<size_t> firstLink;
+	bool compileFailed = false;
+	for (auto b : active) {
+		int status = b->finishCompiles();
+		if (status < 0) {
+			linking.push_back(b);
+			firstLink.push_back(links.size());
+			links.insert(links.end(), b->links.begin(), b->links.end());
+		} else if (status != 0) {
+			compileFailed = true;
+			result = status;
+		}
+	}
+	if (compileFailed) std::cerr << "Build failed." << std::endl;
+
+	// Without -k, a failed build stops the others from linking.
+	if (!compileFailed || options.keepGoing) runJobs(links, options.jobs, options.keepGoing, options.maxLoad);
+	for (size_t i = 0; i < linking.size(); i++) result = std::max(result, linking[i]->finishLinks(links.data() + firstLink[i]));
+
+	if (result == 0 && !links.empty()) std::cout << "Build completed successfully!" << std::endl;
+	return result;
+}
+
+bool hasPic(const std::string& flags) {
+	for (const auto& flag : splitArgs(flags)) {
+		if (flag == "-fPIC" || flag == "-fpic") return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// the builds a project needs. a library wanted shared whose flags don't
+// make position independent code already is compiled with -fPIC, into
+// .pic/ in its build directory, so a static one from the same sources
+// keeps its own objects. variants holds the projects made for that.
+//-----------------------------------------------------------------------------
+void addBuilds(Project& project, const std::string& label, const BuildOptions& options, BuildGraph* previous, SharedState& shared,
+               std::vector<std::unique_ptr<ProjectBuild>>& builds, std::deque<Project>& variants) {
+	if (project.type != TYPE_LIBRARY) {
+		if (project.output.empty()) project.output = "./" + project.name;
+		builds.emplace_back(new ProjectBuild(project, {{OUTPUT_PROGRAM, project.output}}, label, options, previous, shared));
+		return;
+	}
+
+	// Output names the library without or with either extension.
+	std::string stem = project.output.empty() ? "./lib" + project.name : project.output;
+	for (const char* ext : {".a", ".so"}) {
+		size_t len = strlen(ext);
+		if (stem.size() > len && stem.compare(stem.size() - len, len, ext) == 0) stem.erase(stem.size() - len);
+	}
+	bool wantStatic = project.library & LIBRARY_STATIC, wantShared = project.library & LIBRARY_SHARED;
+	// Flags that already have -fPIC (every one that's set) make objects
+	// both can use.
+	bool pic = !project.cFlags.empty() || !project.cxxFlags.empty();
+	for (const std::string* flags : {&project.cFlags, &project.cxxFlags}) pic = pic && (flags->empty() || hasPic(*flags));
+	project.output = stem + (wantShared ? ".so" : ".a");
+
+	std::vector<Output> outputs;
+	if (wantStatic) outputs.push_back({OUTPUT_STATIC, stem + ".a"});
+	if (wantShared && pic) outputs.push_back({OUTPUT_SHARED, stem + ".so"});
+	if (!outputs.empty()) builds.emplace_back(new ProjectBuild(project, outputs, label, options, previous, shared));
+	if (!wantShared || pic) return;
+
+	variants.push_back(project);
+	Project& picProject = variants.back();
+	picProject.buildDir += "/.pic";
+	picProject.cFlags += picProject.cFlags.empty() ? "-fPIC" : " -fPIC";
+	picProject.cxxFlags += picProject.cxxFlags.empty() ? "-fPIC" : " -fPIC";
+	std::string picLabel = wantStatic ? (label.empty() ? "" : label + ", ") + "shared" : label;
+	builds.emplace_back(new ProjectBuild(picProject, {{OUTPUT_SHARED, stem + ".so"}}, picLabel, options, outputs.empty() ? previous : nullptr, shared));
+}
+
+} // namespace
+
+int build(Project& project, const BuildOptions& options, BuildGraph* previous, const std::string& label) {
+	SharedState shared;
+	std::vector<std::unique_ptr<ProjectBuild>> builds;
+	std::deque<Project> variants;
+	addBuilds(project, label, options, previous, shared, builds, variants);
+	return runBuilds(builds, options, shared);
+}
+
+int build(std::vector<Project>& projects, const BuildOptions& options) {
+	SharedState shared;
+	std::vector<std::unique_ptr<ProjectBuild>> builds;
+	std::deque<Project> variants;
+	for (auto& project : projects) addBuilds(project, projects.size() > 1 ? project.configuration : "", options, nullptr, shared, builds, variants);
+	return runBuilds(builds, options, shared);
+}
@@ -0,0 +1,31 @@
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include "Graph.h"
+#include "Project.h"
+
+#include <string>
+#include <vector>
+
+struct BuildOptions {
+	int jobs = 1;
+	bool keepGoing = false;
+	bool alwaysMake = false;
+	double maxLoad = 0; // no new jobs while the load average is this high, 0 = no limit
+	bool explainSchedule = false;
+};
+
+// previous, if given, is the graph from the last build in this process. it's
+// used instead of the graph file and replaced with the new graph. label, if
+// given, goes after each job in the output.
+int build(Project& project, const BuildOptions& options, BuildGraph* previous = nullptr, const std::string& label = "");
+
+// the environment variables that decide what the commands look like, as
+// NAME=value lines
+std::string buildEnvironment();
+
+// builds several configurations of a project in one go, their compiles and
+// links sharing the -j slots
+int build(std::vector<Project>& projects, const BuildOptions& options);
+
+#endif /* BUILDER_H */
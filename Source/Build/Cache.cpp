@@ -0,0 +1,256 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Cache.cpp
+// Purpose: content-addressed object cache shared by every project.
+//
+// Objects are stored under <dir>/<2 hex>/<62 hex>.o, keyed on a SHA-256 of
+// the preprocessed source, the compiler and the flags (and the working
+// directory for debug builds). A hit is used without checking, so the key
+// is a real digest. An entry's mtime is bumped on every hit, so eviction is
+// just "delete the oldest files".
+//
+//===================================================================//
+
+#include "Cache.h"
+#include "Remote.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/HashUtils.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct CacheStats {
+	unsigned long long hits = 0, misses = 0, size = 0;
+};
+
+static CacheStats readStats(const std::string& dir) {
+	CacheStats stats;
+	std::istringstream in(readFile(dir + "/stats"));
+	std::string key;
+	unsigned long long value;
+	while (in >> key >> value) {
+		if (key == "hits") stats.hits = value;
+		else if (key == "misses") stats.misses = value;
+		else if (key == "size") stats.size = value;
+	}
+	return stats;
+}
+
+static void writeStats(const std::string& dir, const CacheStats& stats) {
+	std::string tmp = dir + "/stats.tmp";
+	writeFile(tmp, "hits " + std::to_string(stats.hits) + "\nmisses " + std::to_string(stats.misses) + "\nsize " + std::to_string(stats.size) + "\n");
+	rename(tmp.c_str(), (dir + "/stats").c_str());
+}
+
+//-----------------------------------------------------------------------------
+// $NMAKE_CACHE_DIR, else $XDG_CACHE_HOME/nmake, else ~/.cache/nmake
+//-----------------------------------------------------------------------------
+std::string defaultCacheDir() {
+	const char* env = getenv("NMAKE_CACHE_DIR");
+	if (env && *env) return env;
+	env = getenv("XDG_CACHE_HOME");
+	if (env && *env) return std::string(env) + "/nmake";
+	env = getenv("HOME");
+	return std::string(env ? env : "/tmp") + "/.cache/nmake";
+}
+
+//-----------------------------------------------------------------------------
+// puts a cached object at dest: hard link, then reflink, then a plain copy
+//-----------------------------------------------------------------------------
+static bool restoreObject(const std::string& entry, const std::string& dest) {
+	unlink(dest.c_str());
+	if (link(entry.c_str(), dest.c_str()) == 0) return true;
+
+	int in = open(entry.c_str(), O_RDONLY | O_CLOEXEC);
+	if (in < 0) return false;
+	int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		close(in);
+		return false;
+	}
+
+	bool ok = ioctl(out, FICLONE, in) == 0;
+	if (!ok) {
+		char buf[65536];
+		ssize_t n;
+		ok = true;
+		while (ok && (n = read(in, buf, sizeof(buf))) > 0) ok = write(out, buf, n) == n;
+		if (n < 0) ok = false;
+	}
+	close(in);
+	close(out);
+	if (!ok) unlink(dest.c_str());
+	return ok;
+}
+
+//-----------------------------------------------------------------------------
+// copies a freshly built object into the cache. goes through a temp file
+// and rename() so other nmake processes never see half an entry.
+//-----------------------------------------------------------------------------
+static unsigned long long storeObject(const std::string& object, const std::string& entry) {
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(entry).parent_path(), ec);
+
+	std::ostringstream tid;
+	tid << std::this_thread::get_id();
+	std::string tmp = entry + ".tmp" + std::to_string(getpid()) + "." + tid.str();
+	if (!std::filesystem::copy_file(object, tmp, std::filesystem::copy_options::overwrite_existing, ec)) return 0;
+
+	// read-only, since the object in the build dir may end up hard linked
+	chmod(tmp.c_str(), 0444);
+	if (rename(tmp.c_str(), entry.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return 0;
+	}
+	return std::filesystem::file_size(entry, ec);
+}
+
+//-----------------------------------------------------------------------------
+// debug info records the compile directory, so an object built in one tree
+// can't stand in for another's when any -g flag is on (ccache's hash_dir)
+//-----------------------------------------------------------------------------
+static bool hasDebugInfo(const std::string& flags) {
+	for (const auto& flag : splitArgs(flags)) {
+		if (flag.compare(0, 2, "-g") == 0 && flag != "-g0") return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// runs the preprocessor, and either restores the object from the cache or
+// compiles it (on the workers, if given) and stores the result. returns a
+// wait status.
+//-----------------------------------------------------------------------------
+int cachedCompile(CompileCache& cache, const CompileStep& step, const std::string& identity, WorkerPool* workers) {
+	std::string preprocessed = step.object + ".i";
+	int status = runProcess(preprocessArgs(step, preprocessed));
+	if (status != 0) {
+		unlink(preprocessed.c_str());
+		return status;
+	}
+
+	Sha256 hasher;
+	hasher.update("nmake-cache-2");
+	hasher.update(identity);
+	hasher.update(step.flags);
+	if (hasDebugInfo(step.flags)) {
+		std::error_code ec;
+		hasher.update(std::filesystem::current_path(ec).string());
+	}
+	bool hashed = hashFile(preprocessed, hasher);
+
+	if (!hashed) {
+		unlink(preprocessed.c_str());
+		cache.misses++;
+		return runProcess(compileArgs(step));
+	}
+
+	std::string key = hasher.hex();
+	std::string entry = cache.dir + "/" + key.substr(0, 2) + "/" + key.substr(2) + ".o";
+
+	if (access(entry.c_str(), R_OK) == 0 && restoreObject(entry, step.object)) {
+		// bump the entry so eviction treats it as recently used
+		utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+		unlink(preprocessed.c_str());
+		cache.hits++;
+		return 0;
+	}
+
+	cache.misses++;
+	// a hard linked object from an earlier hit must not be written through
+	unlink(step.object.c_str());
+	status = workers ? remoteCompile(*workers, step, preprocessed) : runProcess(compileArgs(step));
+	unlink(preprocessed.c_str());
+	if (status == 0) cache.stored += storeObject(step.object, entry);
+	return status;
+}
+
+//-----------------------------------------------------------------------------
+// deletes least recently used entries until the cache is below 90% of
+// maxSize. returns the new total size.
+//-----------------------------------------------------------------------------
+static unsigned long long evict(const std::string& dir, unsigned long long maxSize) {
+	struct Entry {
+		std::string path;
+		long long mtime;
+		unsigned long long size;
+	};
+	std::vector<Entry> entries;
+	unsigned long long total = 0;
+
+	std::error_code ec;
+	for (auto it = std::filesystem::recursive_directory_iterator(dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+		if (!it->is_regular_file(ec) || it->path().extension() != ".o") continue;
+		struct stat st;
+		if (stat(it->path().c_str(), &st) != 0) continue;
+		entries.push_back({it->path().string(), (long long)st.st_mtime, (unsigned long long)st.st_size});
+		total += st.st_size;
+	}
+
+	if (total <= maxSize) return total;
+
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		return a.mtime < b.mtime;
+	});
+
+	unsigned long long target = maxSize / 10 * 9;
+	for (const auto& e : entries) {
+		if (total <= target) break;
+		if (unlink(e.path.c_str()) == 0) total -= e.size;
+	}
+	return total;
+}
+
+//-----------------------------------------------------------------------------
+// folds this run's counters into the shared stats file and evicts if the
+// cache grew past its limit. the lock keeps parallel nmakes from racing.
+//-----------------------------------------------------------------------------
+void finishCache(CompileCache& cache) {
+	if (cache.hits == 0 && cache.misses == 0) return;
+
+	std::error_code ec;
+	std::filesystem::create_directories(cache.dir, ec);
+	int fd = open((cache.dir + "/stats.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) return;
+	flock(fd, LOCK_EX);
+
+	CacheStats stats = readStats(cache.dir);
+	stats.hits += cache.hits;
+	stats.misses += cache.misses;
+	stats.size += cache.stored;
+	if (stats.size > cache.maxSize) stats.size = evict(cache.dir, cache.maxSize);
+	writeStats(cache.dir, stats);
+
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+void printCacheStats(const std::string& dir, unsigned long long maxSize) {
+	CacheStats stats = readStats(dir);
+	unsigned long long lookups = stats.hits + stats.misses;
+
+	printf("cache directory    %s\n", dir.c_str());
+	printf("hits               %llu\n", stats.hits);
+	printf("misses             %llu\n", stats.misses);
+	printf("hit rate           %.1f %%\n", lookups ? 100.0 * stats.hits / lookups : 0.0);
+	printf("cache size         %.1f MB of %.1f MB\n", stats.size / 1048576.0, maxSize / 1048576.0);
+}
+
+bool clearCache(const std::string& dir) {
+	std::error_code ec;
+	std::filesystem::remove_all(dir, ec);
+	return !ec;
+}
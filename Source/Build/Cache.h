@@ -0,0 +1,24 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "Compile.h"
+
+#include <atomic>
+#include <string>
+
+struct WorkerPool;
+
+struct CompileCache {
+	std::string dir;
+	unsigned long long maxSize = 5120ULL << 20;
+	std::atomic<int> hits{0}, misses{0};
+	std::atomic<unsigned long long> stored{0};
+};
+
+std::string defaultCacheDir();
+int cachedCompile(CompileCache& cache, const CompileStep& step, const std::string& identity, WorkerPool* workers = nullptr);
+void finishCache(CompileCache& cache);
+void printCacheStats(const std::string& dir, unsigned long long maxSize);
+bool clearCache(const std::string& dir);
+
+#endif /* CACHE_H */
@@ -0,0 +1,72 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Compile.cpp
+// Purpose: builds the command lines for a single translation unit.
+//
+//===================================================================//
+
+#include "Compile.h"
+#include "../Utils/ProcessUtils.h"
+
+//-----------------------------------------------------------------------------
+// compiler and flags come from the config and get split into words, every
+// path is passed through as a single argument. if the config strings use
+// shell syntax ($(...), backticks...) the whole thing goes through sh.
+//-----------------------------------------------------------------------------
+static std::vector<std::string> buildArgs(const CompileStep& step, const std::vector<std::string>& middle) {
+	if (needsShell(step.compiler) || needsShell(step.flags)) {
+		std::string command = step.compiler + " " + joinArgs(middle) + " " + step.flags;
+		return {"/bin/sh", "-c", command};
+	}
+
+	std::vector<std::string> args = splitArgs(step.compiler);
+	args.insert(args.end(), middle.begin(), middle.end());
+	for (auto& flag : splitArgs(step.flags)) args.push_back(flag);
+	return args;
+}
+
+std::vector<std::string> compileArgs(const CompileStep& step) {
+	std::vector<std::string> middle = {"-c", step.source, "-o", step.object};
+	if (!step.depFile.empty()) middle.insert(middle.end(), {"-MMD", "-MF", step.depFile});
+	return buildArgs(step, middle);
+}
+
+//-----------------------------------------------------------------------------
+// same as the compile but stops after the preprocessor. the depfile gets
+// written here too, so a cache hit still leaves a fresh one behind.
+//-----------------------------------------------------------------------------
+std::vector<std::string> preprocessArgs(const CompileStep& step, const std::string& output) {
+	std::vector<std::string> middle = {"-E", step.source, "-o", output};
+	if (!step.depFile.empty()) middle.insert(middle.end(), {"-MMD", "-MT", step.object, "-MF", step.depFile});
+	return buildArgs(step, middle);
+}
+
+std::string compileCommand(const CompileStep& step) {
+	return joinArgs(compileArgs(step));
+}
+
+//-----------------------------------------------------------------------------
+// the compile command with $in, $out and $depfile for the paths, the same
+// for every file built with the same settings
+//-----------------------------------------------------------------------------
+std::string commandTemplate(const CompileStep& step) {
+	CompileStep t = step;
+	t.source = "$in";
+	t.object = "$out";
+	if (!t.depFile.empty()) t.depFile = "$depfile";
+	return compileCommand(t);
+}
+
+std::vector<std::string> linkArgs(const std::string& linker, const std::string& flags, const std::string& output, const std::vector<std::string>& objects) {
+	if (needsShell(linker) || needsShell(flags)) {
+		std::string command = linker + " -o " + quoteArg(output) + " " + flags + " " + joinArgs(objects);
+		return {"/bin/sh", "-c", command};
+	}
+
+	std::vector<std::string> args = splitArgs(linker);
+	args.push_back("-o");
+	args.push_back(output);
+	for (auto& flag : splitArgs(flags)) args.push_back(flag);
+	args.insert(args.end(), objects.begin(), objects.end());
+	return args;
+}
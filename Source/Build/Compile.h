@@ -0,0 +1,21 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <string>
+#include <vector>
+
+struct CompileStep {
+	std::string compiler;
+	std::string flags;
+	std::string source;
+	std::string object;
+	std::string depFile; // empty if the compiler can't write one
+};
+
+std::vector<std::string> compileArgs(const CompileStep& step);
+std::vector<std::string> preprocessArgs(const CompileStep& step, const std::string& output);
+std::string compileCommand(const CompileStep& step);
+std::string commandTemplate(const CompileStep& step);
+std::vector<std::string> linkArgs(const std::string& linker, const std::string& flags, const std::string& output, const std::vector<std::string>& objects);
+
+#endif /* COMPILE_H */
@@ -0,0 +1,89 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: DepFile.cpp
+// Purpose: parses the make-style depfiles written by -MMD -MF.
+//
+//===================================================================//
+
+#include "DepFile.h"
+#include "../Utils/FileUtils.h"
+
+//-----------------------------------------------------------------------------
+// collects every prerequisite from a depfile in one pass. handles line
+// continuations, escaped spaces/#'s and $$, and multiple rules (targets are
+// dropped). returns false if the file doesn't look like a depfile.
+//-----------------------------------------------------------------------------
+bool parseDepFile(const std::string& contents, std::vector<std::string>& deps) {
+	std::string word;
+	bool inTargets = true, sawRule = false;
+	size_t n = contents.size();
+
+	auto flush = [&](bool beforeColon) {
+		if (word.empty()) return;
+		if (!inTargets && !beforeColon) deps.push_back(word);
+		word.clear();
+	};
+
+	for (size_t i = 0; i < n; i++) {
+		char c = contents[i];
+		switch (c) {
+			case '\\':
+				if (i + 1 < n && contents[i+1] == '\n') {
+					flush(false);
+					i++;
+				} else if (i + 2 < n && contents[i+1] == '\r' && contents[i+2] == '\n') {
+					flush(false);
+					i += 2;
+				} else if (i + 1 < n && (contents[i+1] == ' ' || contents[i+1] == '#' || contents[i+1] == '\\')) {
+					word += contents[++i];
+				} else word += c;
+				break;
+			case '$':
+				if (i + 1 < n && contents[i+1] == '$') i++;
+				word += '$';
+				break;
+			case ':':
+				// "C:/foo" style paths and "a.o:" can't be told apart without
+				// looking ahead, a rule separator is followed by space or eol
+				if (inTargets && (i + 1 >= n || contents[i+1] == ' ' || contents[i+1] == '\t' || contents[i+1] == '\n' || contents[i+1] == '\r')) {
+					flush(true);
+					inTargets = false;
+					sawRule = true;
+				} else word += c;
+				break;
+			case ' ':
+			case '\t':
+			case '\r':
+				flush(inTargets);
+				break;
+			case '\n':
+				flush(inTargets);
+				inTargets = true;
+				break;
+			default:
+				word += c;
+				break;
+		}
+	}
+	flush(inTargets);
+
+	return sawRule;
+}
+
+//-----------------------------------------------------------------------------
+// true if the object has to be rebuilt because its depfile is missing or
+// one of the files listed in it changed (or went away) since
+//-----------------------------------------------------------------------------
+bool dependenciesChanged(const std::string& object, const std::string& depFile) {
+	std::vector<std::string> deps;
+	if (!parseDepFile(readFile(depFile), deps)) return true;
+
+	long long built = modifiedTime(object);
+	if (built < 0) return true;
+
+	for (const auto& dep : deps) {
+		long long t = modifiedTime(dep);
+		if (t < 0 || t > built) return true;
+	}
+	return false;
+}
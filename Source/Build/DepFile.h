@@ -0,0 +1,10 @@
+#ifndef DEPFILE_H
+#define DEPFILE_H
+
+#include <string>
+#include <vector>
+
+bool parseDepFile(const std::string& contents, std::vector<std::string>& deps);
+bool dependenciesChanged(const std::string& object, const std::string& depFile);
+
+#endif /* DEPFILE_H */
@@ -0,0 +1,134 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Explain.cpp
+// Purpose: nmake explain, says why an object was compiled, from what
+// the build graph recorded.
+//
+//===================================================================//
+
+#include "Explain.h"
+#include "Graph.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+//-----------------------------------------------------------------------------
+// the words of a command, looking inside sh -c for commands that needed a
+// shell
+//-----------------------------------------------------------------------------
+static std::vector<std::string> commandWords(const std::string& command) {
+	std::vector<std::string> words = splitArgs(command);
+	if (words.size() == 3 && words[0] == "/bin/sh" && words[1] == "-c") return splitArgs(words[2]);
+	return words;
+}
+
+//-----------------------------------------------------------------------------
+// each word of a that isn't matched by one in b, in order
+//-----------------------------------------------------------------------------
+static std::string missingWords(std::vector<std::string> a, std::vector<std::string> b) {
+	std::string missing;
+	for (const auto& word : a) {
+		auto it = std::find(b.begin(), b.end(), word);
+		if (it != b.end()) {
+			b.erase(it);
+			continue;
+		}
+		missing += (missing.empty() ? "" : " ") + quoteArg(word);
+	}
+	return missing;
+}
+
+std::string describeCommandChange(const std::string& before, const std::string& after) {
+	std::string reason = "its compile command changed";
+	// Graphs from before commands were kept only have the hash.
+	if (before.empty()) return reason;
+
+	std::vector<std::string> was = commandWords(before), now = commandWords(after);
+	std::vector<std::string> changes;
+	if (!was.empty() && !now.empty() && was[0] != now[0]) {
+		changes.push_back("the compiler went from " + quoteArg(was[0]) + " to " + quoteArg(now[0]));
+		was.erase(was.begin());
+		now.erase(now.begin());
+	}
+	std::string removed = missingWords(was, now), added = missingWords(now, was);
+	if (!removed.empty()) changes.push_back(removed + " removed");
+	if (!added.empty()) changes.push_back(added + " added");
+	if (changes.empty()) changes.push_back("the same flags in a different order");
+
+	for (size_t i = 0; i < changes.size(); i++) reason += (i == 0 ? ": " : ", ") + changes[i];
+	return reason;
+}
+
+static std::string normalPath(const std::string& path) {
+	return std::filesystem::path(path).lexically_normal().string();
+}
+
+static void replaceAll(std::string& str, const std::string& from, const std::string& to) {
+	for (size_t pos = 0; (pos = str.find(from, pos)) != std::string::npos; pos += to.size()) str.replace(pos, from.size(), to);
+}
+
+//-----------------------------------------------------------------------------
+// looks the file up as an object and as a source in the graph of every
+// configuration being built
+//-----------------------------------------------------------------------------
+int explain(const std::vector<Project>& projects, const std::string& file) {
+	std::string wanted = normalPath(file);
+	bool found = false;
+
+	// Shared libraries and nmake pgo build variants of their own inside
+	// the build directory.
+	std::vector<std::pair<const Project*, std::string>> buildDirs;
+	for (const auto& project : projects) {
+		for (const char* variant : {"", "/.pic", "/.pgo/instrument", "/.pgo/use"}) buildDirs.push_back({&project, project.buildDir + variant});
+	}
+
+	for (const auto& buildDir : buildDirs) {
+		const Project& project = *buildDir.first;
+		BuildGraph graph;
+		std::string error;
+		if (!graph.load(buildDir.second + "/.nmake/graph", error)) continue;
+
+		for (const auto& target : graph.targets) {
+			const GraphNode& object = graph.nodes[target.object];
+			const GraphNode& source = graph.nodes[target.source];
+			if (normalPath(object.path) != wanted && normalPath(source.path) != wanted) continue;
+
+			if (found) std::cout << std::endl;
+			found = true;
+			std::cout << "'" << object.path << "', compiled from '" << source.path << "'";
+			if (!project.configuration.empty()) std::cout << " (" << project.configuration << ")";
+			std::cout << ":" << std::endl;
+			if (target.reason.empty()) std::cout << "  Compiled before the build graph kept track of why." << std::endl;
+			else std::cout << "  Last compiled because " << target.reason << "." << std::endl;
+
+			if (!target.command.empty()) {
+				std::string command = target.command;
+				replaceAll(command, "'$in'", quoteArg(source.path));
+				replaceAll(command, "'$out'", quoteArg(object.path));
+				replaceAll(command, "'$depfile'", quoteArg(object.path + ".d"));
+				std::cout << "  Command: " << command << std::endl;
+			}
+
+			// Only the files can be checked here, a changed command shows up
+			// once the config is planned.
+			std::string changed;
+			if (fileState(object.path) != object.state) changed = "'" + object.path + "' was changed or deleted";
+			else if (fileState(source.path) != source.state) changed = "'" + source.path + "' changed";
+			for (uint32_t input : target.inputs) {
+				if (!changed.empty()) break;
+				if (fileState(graph.nodes[input].path) != graph.nodes[input].state) changed = "'" + graph.nodes[input].path + "' changed";
+			}
+			if (changed.empty()) std::cout << "  None of its files changed since." << std::endl;
+			else std::cout << "  The next build compiles it again, " << changed << " since." << std::endl;
+		}
+	}
+
+	if (!found) {
+		std::cerr << "nmake: no object built from or as '" << file << "' in the build graph, has it been built?" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef EXPLAIN_H
+#define EXPLAIN_H
+
+#include "Project.h"
+
+#include <string>
+#include <vector>
+
+// why a compile was needed when the command is all that changed, from the
+// command templates of the last build and this one
+std::string describeCommandChange(const std::string& before, const std::string& after);
+
+// nmake explain <file>: why an object (or the object built from a source)
+// was last compiled, and whether the next build compiles it again
+int explain(const std::vector<Project>& projects, const std::string& file);
+
+#endif /* EXPLAIN_H */
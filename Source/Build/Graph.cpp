@@ -0,0 +1,278 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Graph.cpp
+// Purpose: the build graph and its on-disk form (BuildDir/.nmake/graph).
+//
+// File layout, all integers in host byte order:
+//
+//   header    GraphHeader
+//   nodes     GraphFileNode[nodeCount]
+//   targets   GraphFileTarget[targetCount]
+//   edges     uint32_t[edgeCount]    (target inputs, as node indices)
+//   strings   char[stringsSize]      (NUL terminated, referenced by offset)
+//
+// The checksum covers everything after the header. Anything that doesn't
+// add up is treated as "no graph", which just means a slower build.
+//
+//===================================================================//
+
+#include "Graph.h"
+#include "../Utils/HashUtils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char GRAPH_MAGIC[8] = {'N', 'M', 'A', 'K', 'E', 'G', 'R', 'F'};
+static const uint32_t GRAPH_VERSION = 5;
+
+struct GraphHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nodeCount;
+	uint32_t targetCount;
+	uint32_t edgeCount;
+	uint32_t stringsSize;
+	uint32_t key;
+	uint32_t linkHash;
+	uint32_t archiveHash;
+	uint64_t checksum;
+};
+
+struct GraphFileNode {
+	uint32_t path;
+	uint32_t kind;
+	int64_t mtime;
+	int64_t size;
+};
+
+struct GraphFileTarget {
+	uint32_t object;
+	uint32_t source;
+	uint32_t firstEdge;
+	uint32_t edgeCount;
+	uint32_t commandHash;
+	uint32_t command;
+	uint32_t reason;
+	uint32_t objectHash;
+	uint32_t durationMs;
+	uint32_t peakRssKb;
+};
+
+static uint64_t checksum(const void* data, size_t len) {
+	Hasher h;
+	h.update(data, len);
+	uint64_t a, b;
+	h.finish(a, b);
+	return a;
+}
+
+uint32_t BuildGraph::addNode(const std::string& path, NodeKind kind) {
+	auto it = nodeIndex.find(path);
+	if (it != nodeIndex.end()) return it->second;
+
+	uint32_t index = nodes.size();
+	nodes.push_back({path, kind, FileState()});
+	nodeIndex[path] = index;
+	return index;
+}
+
+int BuildGraph::findNode(const std::string& path) const {
+	auto it = nodeIndex.find(path);
+	return it == nodeIndex.end() ? -1 : (int)it->second;
+}
+
+int BuildGraph::findTarget(uint32_t object) const {
+	auto it = targetIndex.find(object);
+	return it == targetIndex.end() ? -1 : (int)it->second;
+}
+
+//-----------------------------------------------------------------------------
+// rebuilds the lookups after targets were pushed straight onto the graph
+//-----------------------------------------------------------------------------
+void BuildGraph::reindex() {
+	nodeIndex.clear();
+	targetIndex.clear();
+	for (uint32_t i = 0; i < nodes.size(); i++) nodeIndex[nodes[i].path] = i;
+	for (uint32_t i = 0; i < targets.size(); i++) targetIndex[targets[i].object] = i;
+}
+
+void BuildGraph::clear() {
+	key.clear();
+	linkHash.clear();
+	archiveHash.clear();
+	nodes.clear();
+	targets.clear();
+	nodeIndex.clear();
+	targetIndex.clear();
+}
+
+//-----------------------------------------------------------------------------
+// maps the graph file and decodes all of it into nodes and targets, since
+// the build looks at every node anyway (each one is stat'ed). on any error
+// the graph is left empty and error says why (empty error = there just
+// wasn't a file yet).
+//-----------------------------------------------------------------------------
+bool BuildGraph::load(const std::string& path, std::string& error) {
+	clear();
+	error.clear();
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(GraphHeader)) {
+		close(fd);
+		error = "truncated file";
+		return false;
+	}
+
+	size_t len = st.st_size;
+	void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		error = "can't map file";
+		return false;
+	}
+
+	const char* base = (const char*)map;
+	GraphHeader header;
+	memcpy(&header, base, sizeof(header));
+
+	auto fail = [&](const char* why) {
+		munmap(map, len);
+		clear();
+		error = why;
+		return false;
+	};
+
+	if (memcmp(header.magic, GRAPH_MAGIC, sizeof(GRAPH_MAGIC)) != 0) return fail("bad magic");
+	if (header.version != GRAPH_VERSION) return fail("unsupported version");
+
+	size_t expected = sizeof(GraphHeader)
+		+ (size_t)header.nodeCount * sizeof(GraphFileNode)
+		+ (size_t)header.targetCount * sizeof(GraphFileTarget)
+		+ (size_t)header.edgeCount * sizeof(uint32_t)
+		+ header.stringsSize;
+	if (expected != len) return fail("size mismatch");
+	if (checksum(base + sizeof(GraphHeader), len - sizeof(GraphHeader)) != header.checksum) return fail("checksum mismatch");
+
+	const GraphFileNode* fileNodes = (const GraphFileNode*)(base + sizeof(GraphHeader));
+	const GraphFileTarget* fileTargets = (const GraphFileTarget*)(fileNodes + header.nodeCount);
+	const uint32_t* edges = (const uint32_t*)(fileTargets + header.targetCount);
+	const char* strings = (const char*)(edges + header.edgeCount);
+
+	if (header.stringsSize == 0 || strings[header.stringsSize - 1] != '\0') return fail("bad string table");
+	auto str = [&](uint32_t offset, std::string& out) {
+		if (offset >= header.stringsSize) return false;
+		out = strings + offset;
+		return true;
+	};
+
+	if (!str(header.key, key) || !str(header.linkHash, linkHash) || !str(header.archiveHash, archiveHash)) return fail("bad string offset");
+
+	nodes.reserve(header.nodeCount);
+	nodeIndex.reserve(header.nodeCount);
+	for (uint32_t i = 0; i < header.nodeCount; i++) {
+		GraphFileNode n;
+		memcpy(&n, fileNodes + i, sizeof(n));
+		GraphNode node;
+		if (!str(n.path, node.path) || n.kind > NODE_UNITY) return fail("bad node");
+		node.kind = (NodeKind)n.kind;
+		node.state.mtime = n.mtime;
+		node.state.size = n.size;
+		nodeIndex[node.path] = i;
+		nodes.push_back(std::move(node));
+	}
+
+	targets.reserve(header.targetCount);
+	targetIndex.reserve(header.targetCount);
+	for (uint32_t i = 0; i < header.targetCount; i++) {
+		GraphFileTarget t;
+		memcpy(&t, fileTargets + i, sizeof(t));
+		if (t.object >= header.nodeCount || t.source >= header.nodeCount) return fail("bad target");
+		if ((uint64_t)t.firstEdge + t.edgeCount > header.edgeCount) return fail("bad edge range");
+
+		GraphTarget target;
+		target.object = t.object;
+		target.source = t.source;
+		target.durationMs = t.durationMs;
+		target.peakRssKb = t.peakRssKb;
+		if (!str(t.commandHash, target.commandHash) || !str(t.command, target.command) || !str(t.reason, target.reason) || !str(t.objectHash, target.objectHash))
+			return fail("bad string offset");
+		target.inputs.resize(t.edgeCount);
+		if (t.edgeCount) memcpy(target.inputs.data(), edges + t.firstEdge, t.edgeCount * sizeof(uint32_t));
+		for (uint32_t input : target.inputs) {
+			if (input >= header.nodeCount) return fail("bad edge");
+		}
+		targetIndex[target.object] = i;
+		targets.push_back(std::move(target));
+	}
+
+	munmap(map, len);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// writes the graph to a temp file and renames it over the old one, so a
+// crash mid-write never leaves a half-written graph behind
+//-----------------------------------------------------------------------------
+bool BuildGraph::save(const std::string& path) const {
+	std::string strings;
+	std::unordered_map<std::string, uint32_t> offsets;
+	auto intern = [&](const std::string& s) {
+		auto it = offsets.find(s);
+		if (it != offsets.end()) return it->second;
+		uint32_t offset = strings.size();
+		strings += s;
+		strings += '\0';
+		offsets[s] = offset;
+		return offset;
+	};
+
+	GraphHeader header;
+	memcpy(header.magic, GRAPH_MAGIC, sizeof(GRAPH_MAGIC));
+	header.version = GRAPH_VERSION;
+	header.key = intern(key);
+	header.linkHash = intern(linkHash);
+	header.archiveHash = intern(archiveHash);
+
+	std::vector<GraphFileNode> fileNodes;
+	fileNodes.reserve(nodes.size());
+	for (const auto& node : nodes)
+		fileNodes.push_back({intern(node.path), (uint32_t)node.kind, node.state.mtime, node.state.size});
+
+	std::vector<GraphFileTarget> fileTargets;
+	std::vector<uint32_t> edges;
+	fileTargets.reserve(targets.size());
+	for (const auto& target : targets) {
+		fileTargets.push_back({target.object, target.source, (uint32_t)edges.size(), (uint32_t)target.inputs.size(), intern(target.commandHash), intern(target.command), intern(target.reason), intern(target.objectHash), target.durationMs, target.peakRssKb});
+		edges.insert(edges.end(), target.inputs.begin(), target.inputs.end());
+	}
+
+	header.nodeCount = fileNodes.size();
+	header.targetCount = fileTargets.size();
+	header.edgeCount = edges.size();
+	header.stringsSize = strings.size();
+
+	std::string body;
+	body.append((const char*)fileNodes.data(), fileNodes.size() * sizeof(GraphFileNode));
+	body.append((const char*)fileTargets.data(), fileTargets.size() * sizeof(GraphFileTarget));
+	body.append((const char*)edges.data(), edges.size() * sizeof(uint32_t));
+	body.append(strings);
+	header.checksum = checksum(body.data(), body.size());
+
+	std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (!f) return false;
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(body.data(), 1, body.size(), f) == body.size();
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
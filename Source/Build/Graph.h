@@ -0,0 +1,63 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "../Utils/FileUtils.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum NodeKind : uint32_t {
+	NODE_DIR,
+	NODE_SOURCE,
+	NODE_HEADER,
+	NODE_OBJECT,
+	NODE_OUTPUT,
+	NODE_UNITY, // a generated unity batch source
+};
+
+struct GraphNode {
+	std::string path;
+	NodeKind kind;
+	FileState state; // as last seen by a successful build
+};
+
+// one compiled object: its source, everything else it read, and how it
+// was built last time
+struct GraphTarget {
+	uint32_t object;
+	uint32_t source;
+	std::vector<uint32_t> inputs;
+	std::string commandHash;
+	std::string command; // the compile command with $in, $out and $depfile for the paths
+	std::string reason;  // why it was last compiled, for nmake explain
+	std::string objectHash; // of the object's contents, when it was last linked
+	uint32_t durationMs = 0;
+	uint32_t peakRssKb = 0; // the most memory compiling it took, 0 if unknown
+};
+
+class BuildGraph {
+public:
+	std::string key;      // hash of everything that would change every command
+	std::string linkHash; // hash of the last successful link command and objects
+	std::string archiveHash; // the same for the last static library update
+
+	std::vector<GraphNode> nodes;
+	std::vector<GraphTarget> targets;
+
+	uint32_t addNode(const std::string& path, NodeKind kind);
+	int findNode(const std::string& path) const;
+	int findTarget(uint32_t object) const;
+	void reindex();
+	void clear();
+
+	bool load(const std::string& path, std::string& error);
+	bool save(const std::string& path) const;
+
+private:
+	std::unordered_map<std::string, uint32_t> nodeIndex;
+	std::unordered_map<uint32_t, uint32_t> targetIndex;
+};
+
+#endif /* GRAPH_H */
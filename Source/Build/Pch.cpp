@@ -0,0 +1,106 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Pch.cpp
+// Purpose: picks, sets up and finds the precompiled header for a build.
+//
+//===================================================================//
+
+#include "Pch.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/HashUtils.h"
+#include "../Utils/ProcessUtils.h"
+#include "../Utils/StringUtils.h"
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+
+bool isCxxSource(const std::string& path) {
+	std::string ext = std::filesystem::path(path).extension().string();
+	return ext == ".cpp" || ext == ".c++" || ext == ".cc" || ext == ".cxx";
+}
+
+//-----------------------------------------------------------------------------
+// the <...> includes at the top of at least half of the C++ sources, in the
+// order they first show up. quoted includes are left out since what they
+// find depends on where the source is.
+//-----------------------------------------------------------------------------
+static std::string commonIncludes(const std::vector<std::string>& sources) {
+	std::map<std::string, int> counts;
+	std::vector<std::string> order;
+	int files = 0;
+	for (const auto& path : sources) {
+		if (!isCxxSource(path)) continue;
+		files++;
+
+		std::ifstream in(path);
+		std::set<std::string> seen;
+		std::string line;
+		bool comment = false;
+		while (std::getline(in, line)) {
+			std::string t = trim(line);
+			if (comment || t.compare(0, 2, "/*") == 0) {
+				comment = t.find("*/") == std::string::npos;
+				continue;
+			}
+			if (t.empty() || t.compare(0, 2, "//") == 0 || t == "#pragma once") continue;
+			if (t.compare(0, 8, "#include") != 0) break;
+
+			std::string include = trim(t.substr(8));
+			if (include.empty() || include[0] != '<' || !seen.insert(include).second) continue;
+			if (counts[include]++ == 0) order.push_back(include);
+		}
+	}
+
+	std::string text;
+	for (const auto& include : order) {
+		if (files >= 2 && counts[include] * 2 >= files) text += "#include " + include + "\n";
+	}
+	return text;
+}
+
+//-----------------------------------------------------------------------------
+// works out the header (PCH = "auto" generates one from the common includes)
+// and where its precompiled form goes. each compiler and flag set gets its
+// own directory, so changing either builds a new one. false if there's
+// nothing to precompile.
+//-----------------------------------------------------------------------------
+bool setupPch(const Project& project, const Tool& compiler, const std::vector<std::string>& sources, const std::string& stateDir, PrecompiledHeader& pch) {
+	pch.header = project.pch;
+	if (project.pch == "auto") {
+		std::string text = commonIncludes(sources);
+		if (text.empty()) return false;
+		pch.header = stateDir + "/pch-auto.hpp";
+		if (readFile(pch.header) != text && !writeFile(pch.header, text)) return false;
+	}
+
+	std::string header = std::filesystem::absolute(pch.header).lexically_normal().string();
+	Hasher h;
+	h.update(compiler.identity());
+	h.update(project.cxxFlags);
+	h.update(header);
+	std::string dir = stateDir + "/pch/" + h.hex().substr(0, 16);
+
+	// Only the current one is worth keeping.
+	std::error_code ec;
+	for (const auto& entry : std::filesystem::directory_iterator(stateDir + "/pch", ec)) {
+		if (entry.path().string() != dir) std::filesystem::remove_all(entry.path(), ec);
+	}
+
+	pch.step.compiler = project.cxx;
+	pch.step.flags = project.cxxFlags;
+	pch.step.source = dir + "/pch.hpp";
+	pch.step.object = pch.step.source + (compiler.clang ? ".pch" : ".gch");
+	pch.step.depFile = pch.step.object + ".d";
+
+	// If the precompiled header can't be used the compiler reads the stub
+	// instead, so a build never depends on it being valid.
+	std::string stub = "#include \"" + header + "\"\n";
+	if (readFile(pch.step.source) != stub && !writeFile(pch.step.source, stub)) return false;
+	return true;
+}
+
+std::string pchFlags(const PrecompiledHeader& pch) {
+	return "-include " + quoteArg(pch.step.source);
+}
@@ -0,0 +1,23 @@
+#ifndef PCH_H
+#define PCH_H
+
+#include "Compile.h"
+#include "Project.h"
+#include "Toolchain.h"
+
+#include <string>
+#include <vector>
+
+// a header compiled once and forced into every C++ compile. step builds it,
+// step.source is a stub that includes the real header and step.object the
+// .gch (gcc) or .pch (clang) the compiler picks up in its place.
+struct PrecompiledHeader {
+	std::string header;
+	CompileStep step;
+};
+
+bool isCxxSource(const std::string& path);
+bool setupPch(const Project& project, const Tool& compiler, const std::vector<std::string>& sources, const std::string& stateDir, PrecompiledHeader& pch);
+std::string pchFlags(const PrecompiledHeader& pch);
+
+#endif /* PCH_H */
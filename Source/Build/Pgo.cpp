@@ -0,0 +1,227 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Pgo.cpp
+// Purpose: nmake pgo, builds an instrumented program, trains it with a
+// function from the config and builds it again with the profile it wrote.
+//
+//===================================================================//
+
+#include "Pgo.h"
+#include "Steps.h"
+#include "Toolchain.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/HashUtils.h"
+#include "../Utils/ProcessUtils.h"
+#include "../Utils/StringUtils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <unistd.h>
+
+static std::string addFlags(const std::string& flags, const std::string& more) {
+	return flags.empty() ? more : flags + " " + more;
+}
+
+//-----------------------------------------------------------------------------
+// every file under dir with this extension, relative to dir
+//-----------------------------------------------------------------------------
+static std::vector<std::string> filesWithExtension(const std::string& dir, const std::string& ext) {
+	std::vector<std::string> files;
+	std::error_code ec;
+	for (auto it = std::filesystem::recursive_directory_iterator(dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+		if (it->path().extension() == ext && it->is_regular_file(ec)) files.push_back(it->path().lexically_relative(dir).string());
+	}
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+//-----------------------------------------------------------------------------
+// llvm-profdata from $LLVM_PROFDATA, or the one that goes with clang:
+// next to it, or on PATH, with its version (clang-17, llvm-profdata-17)
+//-----------------------------------------------------------------------------
+static std::string findProfdata(const Tool& compiler) {
+	std::string tool = getEnvVar("LLVM_PROFDATA");
+	if (!tool.empty()) return tool;
+
+	std::filesystem::path path(compiler.path);
+	std::string name = path.filename().string();
+	size_t dash = name.rfind('-');
+	std::string version = dash != std::string::npos && dash + 1 < name.size() && isDigits(name.substr(dash + 1)) ? name.substr(dash) : "";
+	for (const std::string& candidate : {"llvm-profdata" + version, std::string("llvm-profdata")}) {
+		std::string local = (path.parent_path() / candidate).string();
+		if (!compiler.path.empty() && access(local.c_str(), X_OK) == 0) return local;
+		std::vector<std::string> found = findExecutables(candidate);
+		if (!found.empty()) return found[0];
+	}
+	return "";
+}
+
+//-----------------------------------------------------------------------------
+// what decides the profile: the instrumented program, and what the
+// training function runs and reads
+//-----------------------------------------------------------------------------
+static std::string trainingKey(const std::string& program, const ConfigFunction& train) {
+	Hasher h;
+	h.update("nmake-pgo-1");
+	hashFile(program, h);
+	for (const auto& cmd : train.commands) h.update(cmd + "\n");
+	for (const auto& input : train.inputs) {
+		FileState state = fileState(input);
+		h.update(input + " " + std::to_string(state.mtime) + " " + std::to_string(state.size) + "\n");
+	}
+	return h.hex();
+}
+
+//-----------------------------------------------------------------------------
+// gcc writes a .gcda next to each instrumented object, and the optimized
+// object reads the one next to it. only those that changed are copied, so
+// objects whose counters came out the same aren't compiled again.
+//-----------------------------------------------------------------------------
+static bool collectGcda(const std::string& from, const std::string& to) {
+	std::vector<std::string> files = filesWithExtension(from, ".gcda");
+	if (files.empty()) {
+		std::cerr << "nmake: training didn't write a profile, does it run $NMAKE_OUTPUT?" << std::endl;
+		return false;
+	}
+
+	std::set<std::string> current(files.begin(), files.end());
+	std::error_code ec;
+	for (const auto& file : filesWithExtension(to, ".gcda")) {
+		if (!current.count(file)) std::filesystem::remove(to + "/" + file, ec);
+	}
+
+	size_t changed = 0;
+	for (const auto& file : files) {
+		std::string data = readFile(from + "/" + file);
+		std::string dest = to + "/" + file;
+		if (fileState(dest).mtime >= 0 && readFile(dest) == data) continue;
+		if (!writeFile(dest, data)) {
+			std::cerr << "nmake: can't write " << dest << std::endl;
+			return false;
+		}
+		changed++;
+	}
+	std::cout << "Profile: " << changed << " of " << files.size() << " .gcda files changed." << std::endl;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// clang writes a .profraw per process into rawDir, llvm-profdata merges
+// them. the merged profile is only replaced when it changed.
+//-----------------------------------------------------------------------------
+static bool mergeProfraw(const std::string& profdata, const std::string& rawDir, const std::string& merged) {
+	std::vector<std::string> files = filesWithExtension(rawDir, ".profraw");
+	if (files.empty()) {
+		std::cerr << "nmake: training didn't write a profile, does it run $NMAKE_OUTPUT?" << std::endl;
+		return false;
+	}
+
+	std::string tmp = merged + ".tmp";
+	std::vector<std::string> args = {profdata, "merge", "-o", tmp};
+	for (const auto& file : files) args.push_back(rawDir + "/" + file);
+	std::cout << "Merging profiles: " << joinArgs(args) << std::endl;
+	if (runProcess(args) != 0) {
+		std::cerr << "Merging the profiles failed." << std::endl;
+		return false;
+	}
+
+	std::error_code ec;
+	if (fileState(merged).mtime >= 0 && readFile(tmp) == readFile(merged)) std::filesystem::remove(tmp, ec);
+	else std::filesystem::rename(tmp, merged, ec);
+	if (ec) {
+		std::cerr << "nmake: can't write " << merged << ": " << ec.message() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// both builds live under .pgo in the build directory, instrument/ and use/,
+// so neither disturbs the other or a plain nmake, and each stays
+// incremental. training only runs again when the instrumented program or
+// the training function changed (or with -B).
+//-----------------------------------------------------------------------------
+int pgo(const Project& project, const Config& config, const BuildOptions& options) {
+	if (project.type == TYPE_LIBRARY) {
+		std::cerr << "nmake pgo builds programs, a library has nothing to train with." << std::endl;
+		return 1;
+	}
+	const ConfigFunction* train = config.findFunction(project.pgoTrain);
+	if (!train) {
+		std::cerr << "nmake pgo runs the training workload from a function in the config, define " << project.pgoTrain << "() or set PGOTrain." << std::endl;
+		return 1;
+	}
+
+	Project probe = project;
+	Toolchain toolchain;
+	if (!resolveToolchain(probe, toolchain)) return 1;
+	bool clang = toolchain.cxx.clang;
+	if (toolchain.cc.clang != clang) {
+		std::cerr << "nmake pgo needs CC and CXX to be the same kind of compiler, both gcc or both clang." << std::endl;
+		return 1;
+	}
+	// g++ would link gcc's profiling runtime, not clang's.
+	if (clang && !toolchain.ld.clang) {
+		std::cerr << "nmake pgo with clang links through clang too, set LD = \"clang++\"." << std::endl;
+		return 1;
+	}
+	std::string profdata;
+	if (clang && (profdata = findProfdata(toolchain.cxx)).empty()) {
+		std::cerr << "nmake: can't find llvm-profdata to merge the profiles with, set LLVM_PROFDATA." << std::endl;
+		return 1;
+	}
+
+	std::string pgoDir = project.buildDir + (!project.buildDir.empty() && project.buildDir.back() == '/' ? "" : "/") + ".pgo";
+	std::string name = std::filesystem::path(project.output.empty() ? project.name : project.output).filename().string();
+	std::string label = project.configuration.empty() ? "" : project.configuration + ", ";
+	// The instrumented program may be run from anywhere.
+	std::string rawDir = std::filesystem::absolute(pgoDir + "/raw").lexically_normal().string();
+	std::string merged = pgoDir + "/merged.profdata";
+
+	Project instrument = project;
+	instrument.buildDir = pgoDir + "/instrument";
+	instrument.output = instrument.buildDir + "/" + name;
+	instrument.lto = false;
+	instrument.profileMode = PROFILE_GENERATE;
+	std::string generate = clang ? "-fprofile-generate=" + quoteArg(rawDir) : "-fprofile-generate -fprofile-update=atomic";
+	instrument.cFlags = addFlags(instrument.cFlags, generate);
+	instrument.cxxFlags = addFlags(instrument.cxxFlags, generate);
+	instrument.ldFlags = addFlags(instrument.ldFlags, "-fprofile-generate");
+	int status = build(instrument, options, nullptr, label + "instrumented");
+	if (status != 0) return status;
+
+	std::string stampPath = pgoDir + "/trained";
+	std::string key = trainingKey(instrument.output, *train);
+	if (!options.alwaysMake && readFile(stampPath) == key && (!clang || fileState(merged).mtime >= 0)) {
+		std::cout << "The profile is up to date, '" << train->name << "' doesn't need to run again." << std::endl;
+	} else {
+		// Counters left from an older build of the program don't fit this one.
+		std::error_code ec;
+		std::filesystem::remove(stampPath, ec);
+		if (clang) std::filesystem::remove_all(rawDir, ec);
+		else for (const auto& file : filesWithExtension(instrument.buildDir, ".gcda")) std::filesystem::remove(instrument.buildDir + "/" + file, ec);
+
+		std::string program = std::filesystem::absolute(instrument.output).lexically_normal().string();
+		setenv("NMAKE_OUTPUT", program.c_str(), 1);
+		std::cout << "Training: running '" << train->name << "' with " << program << std::endl;
+		if (!runCall(config, train->name, options)) {
+			std::cerr << "Training failed." << std::endl;
+			return 1;
+		}
+		if (clang ? !mergeProfraw(profdata, rawDir, merged) : !collectGcda(instrument.buildDir, pgoDir + "/use")) return 1;
+		writeFile(stampPath, key);
+	}
+
+	Project use = project;
+	use.buildDir = pgoDir + "/use";
+	use.profileMode = PROFILE_USE;
+	use.profile = clang ? merged : "";
+	std::string useFlags = clang ? "-fprofile-use=" + quoteArg(merged) + " -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date"
+	                             : "-fprofile-use -Wno-missing-profile";
+	use.cFlags = addFlags(use.cFlags, useFlags);
+	use.cxxFlags = addFlags(use.cxxFlags, useFlags);
+	return build(use, options, nullptr, label + "optimized");
+}
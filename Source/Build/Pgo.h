@@ -0,0 +1,12 @@
+#ifndef PGO_H
+#define PGO_H
+
+#include "Builder.h"
+#include "Project.h"
+#include "../Config/Config.h"
+
+// nmake pgo: builds the program instrumented, runs the config's training
+// function with it, then builds it again optimized with the profile
+int pgo(const Project& project, const Config& config, const BuildOptions& options);
+
+#endif /* PGO_H */
@@ -0,0 +1,143 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Progress.cpp
+// Purpose: prints job output in one piece as each job finishes, under a
+// live progress line when stdout is a terminal.
+//
+//===================================================================//
+
+#include "Progress.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// the status line is redrawn at most this often
+static const std::chrono::milliseconds REDRAW_INTERVAL(100);
+
+static const char CLEAR_LINE[] = "\r\033[K";
+
+//-----------------------------------------------------------------------------
+// write() that finishes short writes. on errors the rest is dropped, the
+// build shouldn't fail because its terminal went away.
+//-----------------------------------------------------------------------------
+static void writeAll(int fd, const std::string& text) {
+	size_t pos = 0;
+	while (pos < text.size()) {
+		ssize_t n = write(fd, text.data() + pos, text.size() - pos);
+		if (n > 0) pos += n;
+		else if (n < 0 && errno == EINTR) continue;
+		else return;
+	}
+}
+
+static int terminalWidth() {
+	struct winsize size;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) return size.ws_col;
+	return 80;
+}
+
+Progress::Progress(size_t total) : total(total), start(std::chrono::steady_clock::now()) {
+	const char* term = getenv("TERM");
+	tty = isatty(STDOUT_FILENO) && !(term && strcmp(term, "dumb") == 0);
+	thread = std::thread(&Progress::printer, this);
+}
+
+Progress::~Progress() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closing = true;
+	}
+	changed.notify_one();
+	thread.join();
+}
+
+void Progress::started(const std::string& description) {
+	std::lock_guard<std::mutex> guard(lock);
+	begun++;
+	running.push_back(description);
+	if (tty) dirty = true;
+	else queue.push_back({STDOUT_FILENO, "[" + std::to_string(begun) + "/" + std::to_string(total) + "] " + description + "\n"});
+	changed.notify_one();
+}
+
+void Progress::finished(const std::string& description, const std::string& output, const std::string& error) {
+	std::lock_guard<std::mutex> guard(lock);
+	done++;
+	auto it = std::find(running.begin(), running.end(), description);
+	if (it != running.end()) running.erase(it);
+	if (!output.empty()) queue.push_back({STDOUT_FILENO, output.back() == '\n' ? output : output + "\n"});
+	if (!error.empty()) queue.push_back({STDERR_FILENO, error + "\n"});
+	dirty = tty;
+	changed.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+// "[done/total] ETA m:ss <newest running job>", cut to the terminal width.
+// the eta assumes the jobs left take as long as the ones done so far.
+//-----------------------------------------------------------------------------
+std::string Progress::statusLine() {
+	std::string line = "[" + std::to_string(done) + "/" + std::to_string(total) + "]";
+	if (done > 0 && done < total) {
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		long eta = (long)(elapsed / done * (total - done) + 0.5);
+		char buf[32];
+		snprintf(buf, sizeof(buf), " ETA %ld:%02ld", eta / 60, eta % 60);
+		line += buf;
+	}
+	if (!running.empty()) line += " " + running.back();
+
+	size_t width = terminalWidth() - 1;
+	if (line.size() > width) line.resize(width);
+	return line;
+}
+
+//-----------------------------------------------------------------------------
+// the printer thread: writes queued output, and keeps the status line
+// at the bottom of it
+//-----------------------------------------------------------------------------
+void Progress::printer() {
+	bool shown = false;
+	auto lastDraw = std::chrono::steady_clock::now() - REDRAW_INTERVAL;
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		bool redraw = dirty && !closing && now - lastDraw >= REDRAW_INTERVAL;
+		if (queue.empty() && !redraw && !closing) {
+			if (dirty) changed.wait_until(guard, lastDraw + REDRAW_INTERVAL);
+			else changed.wait(guard);
+			continue;
+		}
+
+		std::vector<Chunk> chunks;
+		chunks.swap(queue);
+		bool finishing = closing;
+		std::string status;
+		if (redraw) {
+			status = statusLine();
+			dirty = false;
+			lastDraw = now;
+		}
+		guard.unlock();
+
+		for (const auto& chunk : chunks) {
+			if (shown) writeAll(STDOUT_FILENO, CLEAR_LINE);
+			shown = false;
+			writeAll(chunk.fd, chunk.text);
+		}
+		if (finishing) {
+			if (shown) writeAll(STDOUT_FILENO, CLEAR_LINE);
+			return;
+		}
+		if (redraw) {
+			writeAll(STDOUT_FILENO, CLEAR_LINE + status);
+			shown = true;
+		}
+
+		guard.lock();
+	}
+}
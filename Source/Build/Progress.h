@@ -0,0 +1,47 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// what runJobs shows while it runs: a redrawn "[done/total] ETA" line on a
+// terminal, one "[n/total] job" line per job otherwise. the actual writes
+// happen on a thread of its own, so a slow terminal never holds up a job.
+class Progress {
+public:
+	Progress(size_t total);
+	~Progress(); // flushes everything and clears the status line
+
+	void started(const std::string& description);
+	// output is everything the job printed, error is nmake's own complaint
+	// about it (empty if it succeeded)
+	void finished(const std::string& description, const std::string& output, const std::string& error);
+
+private:
+	struct Chunk {
+		int fd;
+		std::string text;
+	};
+
+	void printer();
+	std::string statusLine();
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<Chunk> queue;
+	std::vector<std::string> running;
+	size_t total;
+	size_t begun = 0;
+	size_t done = 0;
+	bool tty;
+	bool dirty = false; // the status line is out of date
+	bool closing = false;
+	std::chrono::steady_clock::time_point start;
+	std::thread thread;
+};
+
+#endif /* PROGRESS_H */
@@ -0,0 +1,57 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include <string>
+
+enum ProjectType : unsigned char {
+	TYPE_UNKNOWN,
+	TYPE_PROGRAM,
+	TYPE_LIBRARY,
+};
+
+// what a library builds, both bits for both
+enum LibraryKind : unsigned char {
+	LIBRARY_STATIC = 1,
+	LIBRARY_SHARED = 2,
+};
+
+// what nmake pgo is building
+enum ProfileMode : unsigned char {
+	PROFILE_NONE,
+	PROFILE_GENERATE, // instrumented, it writes a profile when it runs
+	PROFILE_USE,      // optimized with the profile the training run wrote
+};
+
+// everything the config file says about how to build the project
+struct Project {
+	std::string name;
+	std::string configuration; // the configuration block it was built from, if any
+	ProjectType type = TYPE_UNKNOWN;
+
+	std::string cc, cxx, as, ld; // ld defaults to g++ with the fastest linker around
+	std::string ar;              // for static libraries, $AR or ar by default
+	unsigned char library = LIBRARY_STATIC;
+	std::string sourceDir = "Source/", buildDir = "Build/", output;
+	std::string cFlags, cxxFlags, asFlags, ldFlags;
+	std::string exclude; // globs of sources and directories the scan leaves out
+
+	bool useCache = true;
+	std::string cacheDir;
+	unsigned long long cacheSize = 5120ULL << 20;
+
+	std::string pch; // header to precompile, or "auto"
+
+	bool unity = false;
+	int unityBatch = 8; // sources per unity batch
+
+	std::string workers; // "unix:/path host:port ..." to compile on
+
+	bool lto = false;               // -flto=auto with gcc, ThinLTO with clang
+	std::string pgoTrain = "train"; // the function nmake pgo runs the instrumented build with
+	ProfileMode profileMode = PROFILE_NONE;
+	std::string profile; // with PROFILE_USE, the merged profile (clang), empty for the .gcda next to each object (gcc)
+
+	std::string configHash;
+};
+
+#endif /* PROJECT_H */
@@ -0,0 +1,412 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Remote.cpp
+// Purpose: sending compiles to nmake workers: the framed protocol, the
+// sockets under it, and the client side.
+//
+//===================================================================//
+
+#include "Remote.h"
+#include "Pch.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// anything bigger is a broken or hostile peer, not a translation unit
+static const uint32_t MAX_FRAME = 512u << 20;
+
+// how long a worker that couldn't be reached is left alone
+static const long long RETRY_DOWN_MS = 10000;
+
+// a compile that takes longer than this on a worker is given up on
+static const int REPLY_TIMEOUT_S = 600;
+
+static const char PROTOCOL[] = "nmake-worker-1";
+
+static void putU32(std::string& out, uint32_t v) {
+	out.append((const char*)&v, sizeof(v));
+}
+
+static void putStr(std::string& out, const std::string& s) {
+	putU32(out, s.size());
+	out += s;
+}
+
+namespace {
+
+// bounds-checked reader, any overrun just makes ok false
+struct Reader {
+	const std::string& data;
+	size_t pos = 0;
+	bool ok = true;
+
+	uint32_t u32() {
+		uint32_t v = 0;
+		if (pos + sizeof(v) > data.size()) {
+			ok = false;
+			return 0;
+		}
+		memcpy(&v, data.data() + pos, sizeof(v));
+		pos += sizeof(v);
+		return v;
+	}
+
+	std::string str() {
+		uint32_t len = u32();
+		if (!ok || len > data.size() - pos) {
+			ok = false;
+			return "";
+		}
+		std::string s = data.substr(pos, len);
+		pos += len;
+		return s;
+	}
+};
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// messages are a protocol name then fields, each a u32 or a u32 length and
+// that many bytes, little endian like every machine we build on
+//-----------------------------------------------------------------------------
+std::string encodeRequest(const CompileRequest& request) {
+	std::string out;
+	putStr(out, PROTOCOL);
+	putU32(out, request.args.size());
+	for (const auto& arg : request.args) putStr(out, arg);
+	putStr(out, request.language);
+	putStr(out, request.toolchain);
+	putStr(out, request.source);
+	return out;
+}
+
+bool decodeRequest(const std::string& data, CompileRequest& request) {
+	Reader in = {data};
+	if (in.str() != PROTOCOL) return false;
+	for (uint32_t n = in.u32(); in.ok && n; n--) request.args.push_back(in.str());
+	request.language = in.str();
+	request.toolchain = in.str();
+	request.source = in.str();
+	return in.ok && in.pos == data.size();
+}
+
+std::string encodeReply(const CompileReply& reply) {
+	std::string out;
+	putStr(out, PROTOCOL);
+	putStr(out, reply.kind);
+	putU32(out, reply.exitCode);
+	putStr(out, reply.diagnostics);
+	putStr(out, reply.object);
+	return out;
+}
+
+bool decodeReply(const std::string& data, CompileReply& reply) {
+	Reader in = {data};
+	if (in.str() != PROTOCOL) return false;
+	reply.kind = in.str();
+	reply.exitCode = in.u32();
+	reply.diagnostics = in.str();
+	reply.object = in.str();
+	return in.ok && in.pos == data.size();
+}
+
+//-----------------------------------------------------------------------------
+// a frame is a u32 length and then the payload
+//-----------------------------------------------------------------------------
+bool sendFrame(int fd, const std::string& payload) {
+	std::string frame;
+	putU32(frame, payload.size());
+	frame += payload;
+	size_t pos = 0;
+	while (pos < frame.size()) {
+		ssize_t n = send(fd, frame.data() + pos, frame.size() - pos, MSG_NOSIGNAL);
+		if (n > 0) pos += n;
+		else if (n < 0 && errno == EINTR) continue;
+		else return false;
+	}
+	return true;
+}
+
+static bool readAll(int fd, char* data, size_t len) {
+	size_t pos = 0;
+	while (pos < len) {
+		ssize_t n = recv(fd, data + pos, len - pos, 0);
+		if (n > 0) pos += n;
+		else if (n < 0 && errno == EINTR) continue;
+		else return false;
+	}
+	return true;
+}
+
+bool readFrame(int fd, std::string& payload) {
+	uint32_t len;
+	if (!readAll(fd, (char*)&len, sizeof(len)) || len > MAX_FRAME) return false;
+	payload.resize(len);
+	return readAll(fd, &payload[0], len);
+}
+
+//-----------------------------------------------------------------------------
+// "unix:/path" or "host:port" (the host may be [bracketed] for ipv6).
+// returns false if it's neither.
+//-----------------------------------------------------------------------------
+static bool parseEndpoint(const std::string& endpoint, std::string& unixPath, std::string& host, std::string& port) {
+	if (endpoint.compare(0, 5, "unix:") == 0) {
+		unixPath = endpoint.substr(5);
+		return !unixPath.empty() && unixPath.size() < sizeof(((sockaddr_un*)nullptr)->sun_path);
+	}
+	size_t colon = endpoint.find_last_of(':');
+	if (colon == std::string::npos || colon + 1 == endpoint.size()) return false;
+	host = endpoint.substr(0, colon);
+	port = endpoint.substr(colon + 1);
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+	return true;
+}
+
+static sockaddr_un unixAddress(const std::string& path) {
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	return addr;
+}
+
+//-----------------------------------------------------------------------------
+// a connected socket, or -1 if the endpoint didn't answer within timeoutMs
+//-----------------------------------------------------------------------------
+int connectEndpoint(const std::string& endpoint, int timeoutMs) {
+	std::string unixPath, host, port;
+	if (!parseEndpoint(endpoint, unixPath, host, port)) return -1;
+
+	auto tryConnect = [&](int family, const sockaddr* addr, socklen_t len) {
+		int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		if (fd < 0) return -1;
+		if (connect(fd, addr, len) != 0) {
+			pollfd p = {fd, POLLOUT, 0};
+			int err = 0;
+			socklen_t errLen = sizeof(err);
+			if (errno != EINPROGRESS || poll(&p, 1, timeoutMs) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) != 0 || err != 0) {
+				close(fd);
+				return -1;
+			}
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+		return fd;
+	};
+
+	if (!unixPath.empty()) {
+		sockaddr_un addr = unixAddress(unixPath);
+		return tryConnect(AF_UNIX, (const sockaddr*)&addr, sizeof(addr));
+	}
+
+	addrinfo hints = {};
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* found;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) return -1;
+	int fd = -1;
+	for (addrinfo* a = found; a && fd < 0; a = a->ai_next) fd = tryConnect(a->ai_family, a->ai_addr, a->ai_addrlen);
+	freeaddrinfo(found);
+	return fd;
+}
+
+//-----------------------------------------------------------------------------
+// a listening socket for the endpoint. a unix socket left behind by a
+// worker that died is replaced. "port" alone listens on 127.0.0.1 only,
+// every interface takes an explicit host like 0.0.0.0 or [::].
+//-----------------------------------------------------------------------------
+int listenEndpoint(const std::string& endpoint, std::string& error) {
+	std::string unixPath, host, port;
+	if (!parseEndpoint(endpoint, unixPath, host, port) && !parseEndpoint(":" + endpoint, unixPath, host, port)) {
+		error = "expected unix:/path or [host:]port";
+		return -1;
+	}
+
+	int fd = -1;
+	if (!unixPath.empty()) {
+		sockaddr_un addr = unixAddress(unixPath);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd >= 0 && bind(fd, (const sockaddr*)&addr, sizeof(addr)) != 0 && errno == EADDRINUSE) {
+			int other = connectEndpoint(endpoint, 200);
+			if (other >= 0) {
+				close(other);
+				close(fd);
+				error = "another worker is listening there";
+				return -1;
+			}
+			unlink(unixPath.c_str());
+			if (bind(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+	} else {
+		addrinfo hints = {};
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* found;
+		if (getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &found) != 0) {
+			error = "can't resolve the address";
+			return -1;
+		}
+		for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+			fd = socket(a->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			int on = 1;
+			if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			if (fd >= 0 && bind(fd, a->ai_addr, a->ai_addrlen) != 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(found);
+	}
+
+	if (fd < 0 || listen(fd, 64) != 0) {
+		error = strerror(errno);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//-----------------------------------------------------------------------------
+// whether a worker runs the compiler with flag: optimization, code
+// generation, warning, machine, standard and debug info flags. nothing
+// that loads code into the compiler, runs another program, or names a
+// file to read or write.
+//-----------------------------------------------------------------------------
+bool remoteFlagAllowed(const std::string& flag) {
+	static const char* const exact[] = {"-w", "-pedantic", "-pedantic-errors", "-pipe", "-pthread"};
+	static const char* const allowed[] = {"-O", "-f", "-W", "-m", "-std=", "-g"};
+	static const char* const denied[] = {"-fplugin", "-fdump", "-fopt-info", "-fcompare-debug", "-fprofile", "-fauto-profile", "-foptimization-record",
+		"-fdiagnostics-add-output", "-fcrash-diagnostics", "-ftime-trace", "-fproc-stat", "-fmodule", "-fprebuilt-module", "-Wa,", "-Wl,", "-Wp,", "-mllvm", "-gsplit-dwarf"};
+	for (const char* option : exact)
+		if (flag == option) return true;
+	if (flag.find('/') != std::string::npos) return false;
+	for (const char* option : denied)
+		if (flag.compare(0, strlen(option), option) == 0) return false;
+	for (const char* option : allowed)
+		if (flag.size() > strlen(option) && flag.compare(0, strlen(option), option) == 0) return true;
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// the compiler and flags a worker can run on a preprocessed file: anything
+// that's only for the preprocessor (include paths, defines, the pch) is
+// left out, it already ran here. empty if the command needs a shell or has
+// a flag a worker wouldn't run.
+//-----------------------------------------------------------------------------
+static std::vector<std::string> remoteArgs(const CompileStep& step) {
+	if (needsShell(step.compiler) || needsShell(step.flags)) return {};
+
+	static const char* const withValue[] = {"-I", "-D", "-U", "-include", "-imacros", "-isystem", "-iquote", "-idirafter", "-MF", "-MT", "-MQ"};
+	std::vector<std::string> args = splitArgs(step.compiler);
+	std::vector<std::string> flags = splitArgs(step.flags);
+	for (size_t i = 0; i < flags.size(); i++) {
+		const std::string& flag = flags[i];
+		bool drop = false;
+		for (const char* option : withValue) {
+			if (flag == option) {
+				i++; // and its value
+				drop = true;
+			} else if (flag.compare(0, strlen(option), option) == 0 && strlen(option) == 2) {
+				drop = true;
+			}
+		}
+		if (drop || flag.compare(0, 2, "-M") == 0) continue;
+		if (!remoteFlagAllowed(flag)) return {};
+		args.push_back(flag);
+	}
+	return args;
+}
+
+static long long nowMs() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//-----------------------------------------------------------------------------
+// sends one compile to the first worker, round robin, that takes it. -1 if
+// none did: they're all busy, down, or refused.
+//-----------------------------------------------------------------------------
+static int tryWorkers(WorkerPool& pool, const CompileStep& step, const CompileRequest& request) {
+	size_t count = pool.endpoints.size();
+	unsigned first = pool.next++;
+	for (size_t k = 0; k < count; k++) {
+		size_t w = (first + k) % count;
+		{
+			std::lock_guard<std::mutex> guard(pool.lock);
+			if (pool.downUntil.size() != count) pool.downUntil.assign(count, 0);
+			if (pool.downUntil[w] > nowMs()) continue;
+		}
+
+		int fd = connectEndpoint(pool.endpoints[w], 500);
+		std::string hello;
+		timeval wait = {2, 0};
+		if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+		if (fd < 0 || !readFrame(fd, hello)) {
+			if (fd >= 0) close(fd);
+			std::lock_guard<std::mutex> guard(pool.lock);
+			pool.downUntil[w] = nowMs() + RETRY_DOWN_MS;
+			continue;
+		}
+		if (hello != "ready") {
+			close(fd); // busy
+			continue;
+		}
+
+		wait.tv_sec = REPLY_TIMEOUT_S;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+		std::string data;
+		CompileReply reply;
+		bool ok = sendFrame(fd, encodeRequest(request)) && readFrame(fd, data) && decodeReply(data, reply);
+		close(fd);
+		if (!ok) {
+			std::lock_guard<std::mutex> guard(pool.lock);
+			pool.downUntil[w] = nowMs() + RETRY_DOWN_MS;
+			continue;
+		}
+		if (reply.kind != "done") continue;
+
+		printOutput(reply.diagnostics);
+		if (reply.exitCode == 0 && !writeFile(step.object, reply.object)) return 1 << 8;
+		pool.remote++;
+		return (reply.exitCode & 0xff) << 8;
+	}
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// compiles step's already preprocessed source on a worker, or here when
+// no worker takes it. returns a wait status.
+//-----------------------------------------------------------------------------
+int remoteCompile(WorkerPool& pool, const CompileStep& step, const std::string& preprocessed) {
+	CompileRequest request;
+	request.args = remoteArgs(step);
+	request.language = isCxxSource(step.source) ? "c++" : "c";
+	auto toolchain = pool.toolchains.find(step.compiler);
+	if (toolchain != pool.toolchains.end()) request.toolchain = toolchain->second;
+	request.source = readFile(preprocessed);
+	if (!request.args.empty() && !pool.endpoints.empty() && access(preprocessed.c_str(), R_OK) == 0) {
+		int status = tryWorkers(pool, step, request);
+		if (status != -1) return status;
+	}
+	pool.local++;
+	return runProcess(compileArgs(step));
+}
+
+//-----------------------------------------------------------------------------
+// preprocesses here (which writes the depfile) and compiles on a worker
+//-----------------------------------------------------------------------------
+int distributedCompile(WorkerPool& pool, const CompileStep& step) {
+	std::string preprocessed = step.object + ".i";
+	int status = runProcess(preprocessArgs(step, preprocessed));
+	if (status == 0) status = remoteCompile(pool, step, preprocessed);
+	unlink(preprocessed.c_str());
+	return status;
+}
@@ -0,0 +1,57 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include "Compile.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// the nmake workers compiles can be sent to. endpoints are "unix:/path" or
+// "host:port".
+struct WorkerPool {
+	std::vector<std::string> endpoints;
+	std::map<std::string, std::string> toolchains; // compiler -> "version\ntarget"
+	std::atomic<int> remote{0}, local{0};
+
+	std::atomic<unsigned> next{0};
+	std::mutex lock;
+	std::vector<long long> downUntil; // ms on the steady clock, per endpoint
+};
+
+// what a client sends once the worker said it has a free slot
+struct CompileRequest {
+	std::vector<std::string> args; // compiler and flags, without -c/-o or any input
+	std::string language;          // "c" or "c++"
+	std::string toolchain;         // the compiler's "version\ntarget" on the client
+	std::string source;            // preprocessed
+};
+
+// and what it gets back. kind is "done", or "refused" when the worker
+// can't or won't run the compiler, then the client compiles it itself.
+struct CompileReply {
+	std::string kind;
+	int exitCode = 0;
+	std::string diagnostics;
+	std::string object;
+};
+
+std::string encodeRequest(const CompileRequest& request);
+bool decodeRequest(const std::string& data, CompileRequest& request);
+std::string encodeReply(const CompileReply& reply);
+bool decodeReply(const std::string& data, CompileReply& reply);
+
+bool remoteFlagAllowed(const std::string& flag);
+
+int connectEndpoint(const std::string& endpoint, int timeoutMs);
+int listenEndpoint(const std::string& endpoint, std::string& error);
+bool sendFrame(int fd, const std::string& payload);
+bool readFrame(int fd, std::string& payload);
+
+int remoteCompile(WorkerPool& pool, const CompileStep& step, const std::string& preprocessed);
+int distributedCompile(WorkerPool& pool, const CompileStep& step);
+int runWorker(const std::vector<std::string>& args, int slots);
+
+#endif /* REMOTE_H */
@@ -0,0 +1,260 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Scan.cpp
+// Purpose: finds the sources under the source directory, leaving out
+// what .nmakeignore and the config exclude without reading those
+// directories at all.
+//
+//===================================================================//
+
+#include "Scan.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+static const char* const SOURCE_EXTENSIONS[] = {".c", ".cpp", ".c++", ".cc", ".cxx", ".asm", ".S"};
+
+// the most threads a scan uses, a few are enough to keep the disk busy
+static const unsigned MAX_SCAN_THREADS = 8;
+
+//-----------------------------------------------------------------------------
+// .nmakeignore in the project directory, one glob per line, then the
+// space separated globs from the config
+//-----------------------------------------------------------------------------
+ScanRules loadScanRules(const std::string& excludes) {
+	ScanRules rules;
+	std::istringstream in(readFile(".nmakeignore"));
+	std::string line;
+	while (std::getline(in, line)) {
+		size_t start = line.find_first_not_of(" \t");
+		size_t end = line.find_last_not_of(" \t\r");
+		if (start == std::string::npos || line[start] == '#') continue;
+		rules.excludes.push_back(line.substr(start, end - start + 1));
+	}
+	for (const auto& glob : splitArgs(excludes)) rules.excludes.push_back(glob);
+	return rules;
+}
+
+bool isSourceFile(const std::string& path) {
+	size_t dot = path.find_last_of("./");
+	if (dot == std::string::npos || path[dot] != '.') return false;
+	for (const char* ext : SOURCE_EXTENSIONS) {
+		if (path.compare(dot, std::string::npos, ext) == 0) return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// * and ? match inside a path component, [...] is a set of characters and
+// ** matches across components ("**/" is any number of directories)
+//-----------------------------------------------------------------------------
+static bool globMatch(const char* p, const char* s) {
+	while (*p) {
+		if (p[0] == '*' && p[1] == '*') {
+			p += 2;
+			bool whole = *p == '/';
+			if (whole) p++;
+			for (const char* t = s;; t++) {
+				if ((!whole || t == s || t[-1] == '/') && globMatch(p, t)) return true;
+				if (!*t) return false;
+			}
+		}
+		if (*p == '*') {
+			p++;
+			for (const char* t = s;; t++) {
+				if (globMatch(p, t)) return true;
+				if (!*t || *t == '/') return false;
+			}
+		}
+		if (!*s) return false;
+
+		if (*p == '?') {
+			if (*s == '/') return false;
+		} else if (*p == '[') {
+			const char* q = p + 1;
+			bool negate = *q == '!' || *q == '^';
+			if (negate) q++;
+			bool found = false;
+			// a ']' right after the '[' is one of the set
+			for (bool first = true; *q && (*q != ']' || first); first = false) {
+				if (q[1] == '-' && q[2] && q[2] != ']') {
+					found = found || (*s >= q[0] && *s <= q[2]);
+					q += 3;
+				} else {
+					found = found || *s == *q;
+					q++;
+				}
+			}
+			if (!*q) {
+				// never closed, so it's just a '['
+				if (*s != '[') return false;
+			} else {
+				if (found == negate || *s == '/') return false;
+				p = q;
+			}
+		} else if (*p != *s) {
+			return false;
+		}
+		p++;
+		s++;
+	}
+	return !*s;
+}
+
+//-----------------------------------------------------------------------------
+// gitignore style: a glob with a '/' in it (or starting with one) matches
+// the path from the project directory, one without matches the name in any
+// directory. a trailing '/' only matches directories.
+//-----------------------------------------------------------------------------
+bool isExcluded(const ScanRules& rules, const std::string& path, bool isDir) {
+	size_t start = 0;
+	while (path.compare(start, 2, "./") == 0) start += 2;
+	const char* rel = path.c_str() + start;
+	const char* name = strrchr(rel, '/');
+	name = name ? name + 1 : rel;
+
+	for (const auto& rule : rules.excludes) {
+		std::string glob = rule;
+		if (glob.back() == '/') {
+			if (!isDir) continue;
+			glob.pop_back();
+		}
+		bool anchored = glob.find('/') != std::string::npos;
+		if (glob[0] == '/') glob.erase(0, 1);
+		if (!glob.empty() && globMatch(glob.c_str(), anchored ? rel : name)) return true;
+	}
+	return false;
+}
+
+namespace {
+
+struct Dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+std::string joinPath(const std::string& dir, const char* name) {
+	return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+//-----------------------------------------------------------------------------
+// reads one directory with getdents64. d_type saves a stat per entry, only
+// symlinks and entries on filesystems that leave it out are stat'ed.
+// dotfiles and dot directories are skipped. a directory with a .nmake in
+// it is a build directory, nothing in it is returned and the result is
+// false, unless it's the root of the scan.
+//-----------------------------------------------------------------------------
+bool readDirectory(const std::string& dir, const ScanRules& rules, std::vector<std::string>& files, std::vector<std::string>& subdirs, bool root) {
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return false;
+
+	size_t firstFile = files.size(), firstDir = subdirs.size();
+	bool buildDir = false;
+	alignas(8) char buf[32768];
+	long n;
+	while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		for (long pos = 0; pos < n;) {
+			const Dirent64* entry = (const Dirent64*)(buf + pos);
+			pos += entry->d_reclen;
+			const char* name = entry->d_name;
+			if (name[0] == '.') {
+				if (strcmp(name, ".nmake") == 0) buildDir = !root;
+				continue;
+			}
+
+			unsigned char type = entry->d_type;
+			struct stat st;
+			if (type == DT_UNKNOWN) {
+				if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+				type = S_ISLNK(st.st_mode) ? DT_LNK : S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+			}
+			// A link to a source counts, linked directories aren't followed.
+			if (type == DT_LNK) {
+				if (fstatat(fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+				type = DT_REG;
+			}
+
+			if (type == DT_DIR) {
+				std::string path = joinPath(dir, name);
+				if (!isExcluded(rules, path, true)) subdirs.push_back(path);
+			} else if (type == DT_REG && isSourceFile(name)) {
+				std::string path = joinPath(dir, name);
+				if (!isExcluded(rules, path, false)) files.push_back(path);
+			}
+		}
+	}
+	close(fd);
+
+	if (buildDir) {
+		files.resize(firstFile);
+		subdirs.resize(firstDir);
+	}
+	return !buildDir;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// every source under root, and every directory that was read (root
+// first), sorted. directories are read by up to MAX_SCAN_THREADS threads,
+// a new one starts while there are more waiting than threads reading.
+//-----------------------------------------------------------------------------
+void scanSources(const std::string& root, const ScanRules& rules, std::vector<std::string>& paths, std::vector<std::string>& dirs) {
+	struct stat st;
+	if (root.empty() || stat(root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::vector<std::string> queue = {root};
+	size_t busy = 0;
+	unsigned maxThreads = std::min(MAX_SCAN_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::thread> threads;
+	size_t firstPath = paths.size(), firstDir = dirs.size();
+
+	std::function<void()> work = [&]() {
+		std::vector<std::string> found, foundDirs, subdirs;
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			if (queue.empty()) {
+				if (busy == 0) break;
+				wake.wait(guard);
+				continue;
+			}
+			std::string dir = std::move(queue.back());
+			queue.pop_back();
+			busy++;
+			guard.unlock();
+
+			subdirs.clear();
+			if (readDirectory(dir, rules, found, subdirs, dir == root)) foundDirs.push_back(dir);
+
+			guard.lock();
+			busy--;
+			for (auto& sub : subdirs) queue.push_back(std::move(sub));
+			if (queue.size() > 1 && threads.size() + 1 < maxThreads) threads.emplace_back(work);
+			if (!queue.empty() || busy == 0) wake.notify_all();
+		}
+		paths.insert(paths.end(), found.begin(), found.end());
+		dirs.insert(dirs.end(), foundDirs.begin(), foundDirs.end());
+	};
+	work();
+	for (auto& t : threads) t.join();
+
+	std::sort(paths.begin() + firstPath, paths.end());
+	std::sort(dirs.begin() + firstDir, dirs.end());
+}
@@ -0,0 +1,18 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <string>
+#include <vector>
+
+// what the source scan leaves out: gitignore style globs from .nmakeignore
+// and the config's Exclude
+struct ScanRules {
+	std::vector<std::string> excludes;
+};
+
+ScanRules loadScanRules(const std::string& excludes);
+bool isSourceFile(const std::string& path);
+bool isExcluded(const ScanRules& rules, const std::string& path, bool isDir);
+void scanSources(const std::string& root, const ScanRules& rules, std::vector<std::string>& paths, std::vector<std::string>& dirs);
+
+#endif /* SCAN_H */
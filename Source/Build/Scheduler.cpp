@@ -0,0 +1,340 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Scheduler.cpp
+// Purpose: runs build jobs concurrently on a fixed number of slots.
+//
+//===================================================================//
+
+#include "Scheduler.h"
+#include "Progress.h"
+#include "Trace.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//-----------------------------------------------------------------------------
+// number of online cpus, used when -j isn't given
+//-----------------------------------------------------------------------------
+int defaultJobCount() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+// a job is only started with at least this much memory free, whatever it's
+// expected to need
+static const unsigned long long MIN_FREE_MEMORY = 256ULL << 20;
+
+// how often a job held back for memory or load checks again
+static const std::chrono::milliseconds RECHECK_INTERVAL(100);
+
+//-----------------------------------------------------------------------------
+// bytes in /proc/meminfo's MemAvailable, or the room left under our cgroup's
+// (and its parents') memory.max if that's less. cgroup v1's memory
+// controller is read too, for hosts that haven't moved over. 0 if nothing
+// can be read.
+//-----------------------------------------------------------------------------
+static unsigned long long availableMemory() {
+	unsigned long long available = 0;
+	std::ifstream meminfo("/proc/meminfo");
+	std::string line;
+	while (std::getline(meminfo, line)) {
+		if (line.compare(0, 13, "MemAvailable:") == 0) {
+			available = strtoull(line.c_str() + 13, nullptr, 10) << 10;
+			break;
+		}
+	}
+
+	// cgroup v2 has a single "0::/path" line, v1 a "N:memory:/path" one
+	std::ifstream self("/proc/self/cgroup");
+	std::string group, root = "/sys/fs/cgroup", maxFile = "/memory.max", currentFile = "/memory.current";
+	while (std::getline(self, line)) {
+		size_t colon = line.find(':');
+		if (line.compare(0, 3, "0::") == 0 && group.empty()) {
+			group = line.substr(3);
+		} else if (colon != std::string::npos && line.compare(colon, 9, ":memory:/") == 0) {
+			group = line.substr(colon + 8);
+			root = "/sys/fs/cgroup/memory";
+			maxFile = "/memory.limit_in_bytes";
+			currentFile = "/memory.usage_in_bytes";
+			break;
+		}
+	}
+	if (group.empty()) return available;
+
+	while (true) {
+		std::string dir = root + (group == "/" ? "" : group);
+		std::string max, current;
+		std::ifstream(dir + maxFile) >> max;
+		std::ifstream(dir + currentFile) >> current;
+		// no limit is "max" in v2, and a huge number in v1
+		if (!max.empty() && max != "max" && !current.empty()) {
+			unsigned long long limit = strtoull(max.c_str(), nullptr, 10);
+			unsigned long long used = strtoull(current.c_str(), nullptr, 10);
+			unsigned long long room = limit > used ? limit - used : 0;
+			if (available == 0 || room < available) available = room;
+		}
+		if (group == "/" || group.empty()) break;
+		group = group.substr(0, group.find_last_of('/'));
+		if (group.empty()) group = "/";
+	}
+	return available;
+}
+
+//-----------------------------------------------------------------------------
+// for every job, the longest chain of costs from it through the jobs that
+// come after it, itself included
+//-----------------------------------------------------------------------------
+static std::vector<double> criticalPaths(const std::vector<Job>& jobs, const std::vector<double>& cost) {
+	std::vector<std::vector<size_t>> successors(jobs.size());
+	std::vector<size_t> waitingOn(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++) {
+		for (size_t dep : jobs[i].after) successors[dep].push_back(i);
+		waitingOn[i] = jobs[i].after.size();
+	}
+
+	// topological order, jobs in a cycle (there shouldn't be any) are left out
+	std::vector<size_t> order;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (waitingOn[i] == 0) order.push_back(i);
+	}
+	for (size_t k = 0; k < order.size(); k++) {
+		for (size_t s : successors[order[k]]) {
+			if (--waitingOn[s] == 0) order.push_back(s);
+		}
+	}
+
+	std::vector<double> path = cost;
+	for (size_t k = order.size(); k-- > 0;) {
+		size_t i = order[k];
+		for (size_t s : successors[i]) path[i] = std::max(path[i], cost[i] + path[s]);
+	}
+	return path;
+}
+
+//-----------------------------------------------------------------------------
+// runs every job with at most maxJobs running at once, each only once the
+// jobs it comes after have succeeded. on the first failure no new jobs are
+// started (unless keepGoing is set, then only the ones that depend on it
+// are skipped), but the ones already running are waited on so we never
+// leave children behind. each job's output is held back and printed in one
+// piece when it finishes.
+//
+// of the jobs that could start, the one with the longest chain of expected
+// time ahead of it (itself and everything after it) goes first, so slow
+// files and the steps holding up others don't end up running alone at the
+// end of the build.
+//
+// past the first job, one only starts while the load average is under
+// maxLoad (0 for no limit) and the memory it's expected to need fits: in
+// what was free when we started, less what the running jobs are expected
+// to need, and in what's free right now. returns true if every job
+// succeeded.
+//-----------------------------------------------------------------------------
+bool runJobs(std::vector<Job>& jobs, int maxJobs, bool keepGoing, double maxLoad) {
+	enum { WAITING, RUNNING, SUCCEEDED, FAILED };
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<char> state(jobs.size(), WAITING);
+	size_t next = 0; // first position in order that might still be waiting
+	int running = 0;
+	bool stop = false;
+	int failed = 0;
+	Progress progress(jobs.size());
+	auto begin = std::chrono::steady_clock::now();
+
+	// Jobs nobody measured yet are guessed to need what the others do on
+	// average.
+	unsigned long long known = 0, knownCount = 0;
+	for (const auto& job : jobs) {
+		if (job.memory) {
+			known += job.memory;
+			knownCount++;
+		}
+	}
+	unsigned long long guess = knownCount ? known / knownCount : 0;
+	std::vector<unsigned long long> need(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++) need[i] = jobs[i].memory ? jobs[i].memory : guess;
+
+	// Same for how long they take.
+	double knownSeconds = 0;
+	size_t timed = 0;
+	for (const auto& job : jobs) {
+		if (job.expected > 0) {
+			knownSeconds += job.expected;
+			timed++;
+		}
+	}
+	std::vector<double> cost(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++) cost[i] = jobs[i].expected > 0 ? jobs[i].expected : timed ? knownSeconds / timed : 1;
+	std::vector<double> path = criticalPaths(jobs, cost);
+	std::vector<size_t> order(jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return path[a] > path[b]; });
+
+	unsigned long long budget = availableMemory();
+	unsigned long long reserved = 0; // what the running jobs are expected to need
+
+	// the first waiting job that can start, jobs.size() if there's none.
+	// held is set if some could but there's no room for them right now.
+	auto pick = [&](bool& held) {
+		held = false;
+		while (next < order.size() && state[order[next]] != WAITING) next++;
+		bool overloaded = false, checked = false;
+		unsigned long long free = 0;
+		for (size_t k = next; k < order.size(); k++) {
+			size_t i = order[k];
+			if (state[i] != WAITING) continue;
+			bool ready = true;
+			for (size_t dep : jobs[i].after) {
+				if (state[dep] == FAILED) {
+					state[i] = FAILED;
+					ready = false;
+					break;
+				}
+				ready = ready && state[dep] == SUCCEEDED;
+			}
+			if (!ready) continue;
+			if (running == 0) return i;
+
+			if (!checked) {
+				double load;
+				overloaded = maxLoad > 0 && getloadavg(&load, 1) == 1 && load >= maxLoad;
+				free = availableMemory();
+				checked = true;
+			}
+			// A smaller job further on may still fit when this one doesn't.
+			bool fits = budget == 0 || (reserved + need[i] <= budget && free >= std::max(need[i], MIN_FREE_MEMORY));
+			if (!overloaded && fits) return i;
+			held = true;
+			if (overloaded) break;
+		}
+		return jobs.size();
+	};
+
+	auto worker = [&](int slot) {
+		while (true) {
+			size_t index;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while (true) {
+					if (stop) return;
+					bool held;
+					index = pick(held);
+					if (index < jobs.size()) break;
+					// Nothing can start: wait for a running job to finish (or
+					// for memory or load to come down), or give up if nothing
+					// is running either.
+					if (held) {
+						changed.wait_for(guard, RECHECK_INTERVAL);
+						continue;
+					}
+					if (next >= jobs.size() || running == 0) {
+						changed.notify_all();
+						return;
+					}
+					changed.wait(guard);
+				}
+				state[index] = RUNNING;
+				running++;
+				reserved += need[index];
+				jobs[index].started = true;
+			}
+
+			Job& job = jobs[index];
+			progress.started(job.description);
+			OutputCapture output;
+			setOutputCapture(&output);
+			takePeakRss();
+			auto start = std::chrono::steady_clock::now();
+			job.startedAt = std::chrono::duration<double>(start - begin).count();
+			long long traceStart = traceEnabled() ? traceNow() : 0;
+			int status = job.run ? job.run() : runProcess(job.args);
+			job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			job.status = status;
+			job.peakRss = takePeakRss();
+			setOutputCapture(nullptr);
+			if (output.dropped) output.text += "\nnmake: " + std::to_string(output.dropped) + " more bytes of output were dropped\n";
+			if (traceEnabled()) {
+				std::string command = !job.command.empty() ? job.command : !job.args.empty() ? joinArgs(job.args) : job.description;
+				traceJob(job.description, job.category, slot, traceStart, traceNow(), command, exitCode(status));
+			}
+			bool interrupted = status != -1 && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT;
+			std::string error = status == 0 ? "" : "nmake: *** [" + job.description + "] Error " + std::to_string(exitCode(status));
+			progress.finished(job.description, output.text, error);
+
+			std::lock_guard<std::mutex> guard(lock);
+			running--;
+			reserved -= need[index];
+			state[index] = status == 0 ? SUCCEEDED : FAILED;
+			if (status != 0) {
+				failed++;
+				if (!keepGoing || interrupted) stop = true;
+			}
+			changed.notify_all();
+		}
+	};
+
+	if (maxJobs < 1) maxJobs = 1;
+	size_t slots = std::min(jobs.size(), (size_t)maxJobs);
+
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < slots; i++) workers.emplace_back(worker, i + 1);
+	for (auto &t : workers) t.join();
+
+	return failed == 0 && std::all_of(state.begin(), state.end(), [](char s) { return s == SUCCEEDED; });
+}
+
+//-----------------------------------------------------------------------------
+// --explain-schedule: how long the jobs took against the best any order on
+// maxJobs slots could have done, which is the longer of the critical path
+// and the total work spread evenly over the slots
+//-----------------------------------------------------------------------------
+void explainSchedule(const std::vector<Job>& jobs, int maxJobs) {
+	std::vector<double> cost(jobs.size());
+	double makespan = 0, work = 0;
+	size_t ran = 0;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (!jobs[i].started) continue;
+		cost[i] = jobs[i].seconds;
+		makespan = std::max(makespan, jobs[i].startedAt + jobs[i].seconds);
+		work += jobs[i].seconds;
+		ran++;
+	}
+	if (ran == 0) return;
+
+	std::vector<double> path = criticalPaths(jobs, cost);
+	double critical = *std::max_element(path.begin(), path.end());
+	size_t slots = std::min(ran, (size_t)std::max(maxJobs, 1));
+	double ideal = std::max(critical, work / slots);
+
+	printf("Schedule: %zu job%s on %zu slot%s\n", ran, ran == 1 ? "" : "s", slots, slots == 1 ? "" : "s");
+	printf("  took          %8.2fs\n", makespan);
+	printf("  total work    %8.2fs\n", work);
+	printf("  critical path %8.2fs\n", critical);
+	printf("  ideal         %8.2fs (%.0f%% of it reached)\n", ideal, makespan > 0 ? ideal / makespan * 100 : 100);
+
+	std::vector<size_t> longest;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (jobs[i].started) longest.push_back(i);
+	}
+	std::sort(longest.begin(), longest.end(), [&](size_t a, size_t b) { return jobs[a].seconds > jobs[b].seconds; });
+	if (longest.size() > 5) longest.resize(5);
+	printf("  longest jobs:\n");
+	for (size_t i : longest) {
+		const Job& job = jobs[i];
+		char expected[32] = "?";
+		if (job.expected > 0) snprintf(expected, sizeof(expected), "%.2fs", job.expected);
+		printf("  %8.2fs  started at %.2fs, expected %s  %s\n", job.seconds, job.startedAt, expected, job.description.c_str());
+	}
+	fflush(stdout);
+}
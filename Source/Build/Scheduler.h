@@ -0,0 +1,30 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct Job {
+	std::string description;
+	std::vector<std::string> args;
+	std::function<int()> run; // runs instead of args if set, returns a wait status
+	std::string command;      // what run does, for the trace, if args don't say
+	const char* category = "compile";
+	std::vector<size_t> after; // jobs that have to succeed before this one starts
+	unsigned long long memory = 0; // bytes it's expected to need at its peak, 0 if unknown
+	double expected = 0; // seconds it's expected to take, 0 if unknown
+
+	// filled in by runJobs
+	bool started = false;
+	int status = 0;
+	double startedAt = 0; // seconds after runJobs was called
+	double seconds = 0;
+	unsigned long long peakRss = 0; // of the processes it ran, 0 if it ran none
+};
+
+int defaultJobCount();
+bool runJobs(std::vector<Job>& jobs, int maxJobs, bool keepGoing, double maxLoad = 0);
+void explainSchedule(const std::vector<Job>& jobs, int maxJobs);
+
+#endif /* SCHEDULER_H */
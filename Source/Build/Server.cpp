@@ -0,0 +1,390 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Server.cpp
+// Purpose: nmake server, keeps a project's config, build graph and an
+// inotify view of its files in memory, so builds started by a plain
+// `nmake` in the project don't have to load or stat anything up front.
+//
+//===================================================================//
+
+#include "Server.h"
+#include "Remote.h"
+#include "Steps.h"
+#include "Watch.h"
+#include "../Utils/HashUtils.h"
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char SERVER_PROTOCOL[] = "nmake-server-1";
+
+// a client gets this long to send its request once connected
+static const timeval REQUEST_TIMEOUT = {5, 0};
+
+// the biggest request, options and environment, in one message
+static const size_t MAX_REQUEST = 65536;
+
+static std::string socketPath;
+
+//-----------------------------------------------------------------------------
+// one socket per project directory, in $XDG_RUNTIME_DIR/nmake or
+// /tmp/nmake-<uid>
+//-----------------------------------------------------------------------------
+std::string serverSocketPath() {
+	const char* runtime = getenv("XDG_RUNTIME_DIR");
+	std::string dir = runtime && *runtime ? std::string(runtime) + "/nmake" : "/tmp/nmake-" + std::to_string(getuid());
+	char cwd[PATH_MAX];
+	std::string here = getcwd(cwd, sizeof(cwd)) ? cwd : ".";
+	return dir + "/" + hashString(here).substr(0, 16) + ".sock";
+}
+
+//-----------------------------------------------------------------------------
+// the socket's directory has to be ours and closed to everyone else, or
+// another user could stand in for the server and get our terminal
+//-----------------------------------------------------------------------------
+static bool privateDir(const std::string& dir, bool create) {
+	if (create) mkdir(dir.c_str(), 0700);
+	struct stat st;
+	return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() && (st.st_mode & 077) == 0;
+}
+
+//-----------------------------------------------------------------------------
+// a frame (see Remote.cpp) with the descriptors riding along on it
+//-----------------------------------------------------------------------------
+static bool sendWithFds(int sock, const std::string& payload, const int* fds, int count) {
+	uint32_t len = payload.size();
+	std::string frame((const char*)&len, sizeof(len));
+	frame += payload;
+
+	char control[CMSG_SPACE(sizeof(int) * 2)] = {};
+	struct iovec io = {&frame[0], frame.size()};
+	struct msghdr msg = {};
+	msg.msg_iov = &io;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+	ssize_t n;
+	while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+	// requests are tiny, a short write here means something's wrong
+	return n == (ssize_t)frame.size();
+}
+
+//-----------------------------------------------------------------------------
+// reads a frame sent by sendWithFds. fds gets whatever descriptors came
+// with it, the caller closes them.
+//-----------------------------------------------------------------------------
+static bool readWithFds(int sock, std::string& payload, std::vector<int>& fds) {
+	std::vector<char> buf(MAX_REQUEST);
+	char control[CMSG_SPACE(sizeof(int) * 2)];
+	struct iovec io = {buf.data(), buf.size()};
+	struct msghdr msg = {};
+	msg.msg_iov = &io;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t n;
+	while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); n >= 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+		size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < count; i++) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			fds.push_back(fd);
+		}
+	}
+
+	uint32_t len;
+	if (n < (ssize_t)sizeof(len) || (msg.msg_flags & MSG_CTRUNC)) return false;
+	memcpy(&len, buf.data(), sizeof(len));
+	if (len != n - sizeof(len)) return false;
+	payload.assign(buf.data() + sizeof(len), len);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// a build request is the options on one line, then the client's
+// buildEnvironment()
+//-----------------------------------------------------------------------------
+static std::string encodeOptions(const BuildOptions& options) {
+	std::ostringstream out;
+	out << SERVER_PROTOCOL << " build " << options.jobs << " " << options.keepGoing << " " << options.alwaysMake << " " << options.maxLoad << " " << options.explainSchedule;
+	out << "\n" << buildEnvironment();
+	return out.str();
+}
+
+static bool decodeOptions(const std::string& data, std::string& command, BuildOptions& options, std::string& environment) {
+	size_t newline = data.find('\n');
+	std::istringstream in(data.substr(0, newline));
+	std::string protocol;
+	in >> protocol >> command;
+	if (protocol != SERVER_PROTOCOL) return false;
+	if (command != "build") return !in.fail();
+	in >> options.jobs >> options.keepGoing >> options.alwaysMake >> options.maxLoad >> options.explainSchedule;
+	if (newline != std::string::npos) environment = data.substr(newline + 1);
+	return !in.fail() && options.jobs > 0;
+}
+
+//-----------------------------------------------------------------------------
+// hands the build to this directory's server if one is running, with our
+// stdout and stderr so its output lands where ours would have. false if
+// there's no server to ask.
+//-----------------------------------------------------------------------------
+bool buildOnServer(const BuildOptions& options, int& status) {
+	std::string path = serverSocketPath();
+	if (!privateDir(std::filesystem::path(path).parent_path().string(), false)) return false;
+	int sock = connectEndpoint("unix:" + path, 1000);
+	if (sock < 0) return false;
+
+	int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+	std::string request = encodeOptions(options), reply;
+	if (request.size() + sizeof(uint32_t) > MAX_REQUEST || !sendWithFds(sock, request, fds, 2)) {
+		close(sock);
+		return false;
+	}
+	if (!readFrame(sock, reply)) {
+		close(sock);
+		std::cerr << "nmake: the build server went away in the middle of the build" << std::endl;
+		status = 1;
+		return true;
+	}
+	close(sock);
+	// The server's idea of the project is stale (the config changed and it's
+	// about to restart) or isn't ours (a different environment).
+	if (reply == "local") return false;
+	status = atoi(reply.c_str());
+	return true;
+}
+
+static void removeSocket(int) {
+	unlink(socketPath.c_str());
+	_exit(0);
+}
+
+namespace {
+
+// what the server knows between requests
+struct ServerState {
+	const Project& project;
+	const Config& config;
+	FileWatcher watcher;
+	BuildGraph graph;
+	bool clean = false;    // built fine, and nothing changed since
+	bool restart = false;  // the config or .nmakeignore changed
+	std::string output;
+};
+
+//-----------------------------------------------------------------------------
+// whether the objects and output are as the last build left them. the
+// watcher doesn't look inside the build directory, so this is a stat of
+// each instead.
+//-----------------------------------------------------------------------------
+bool outputsIntact(const BuildGraph& graph) {
+	for (const auto& node : graph.nodes) {
+		if ((node.kind == NODE_OBJECT || node.kind == NODE_OUTPUT) && fileState(node.path) != node.state) return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// what a plain `nmake` would do: the config's steps, then the build. when
+// the watcher saw nothing change since the last good build, and the build's
+// own files are all still there, the build is answered without looking at
+// the sources. the caller has checked the config and environment are the
+// ones the server has.
+//-----------------------------------------------------------------------------
+int serveBuild(ServerState& state, const BuildOptions& options) {
+	if (!runSteps(state.config, options)) {
+		std::cerr << "Build failed." << std::endl;
+		state.clean = false;
+		return 1;
+	}
+
+	if (state.clean && !options.alwaysMake && outputsIntact(state.graph)) {
+		std::cout << "Nothing to be done, '" << state.output << "' is up to date." << std::endl;
+		return 0;
+	}
+
+	Project current = state.project;
+	int status = build(current, options, &state.graph);
+	state.watcher.addWatches(state.graph, current);
+	state.output = current.output;
+
+	// The build writes its output and maybe creates the build directory
+	// next to the config, that's not a change.
+	WatchEvents during;
+	state.watcher.read(during);
+	std::string buildName = std::filesystem::path(current.buildDir).lexically_normal().begin()->string();
+	std::string outputName = std::filesystem::path(current.output).filename().string();
+	bool changed = during.changed;
+	for (const auto& name : during.rootNames) changed = changed || (name != buildName && name != outputName);
+	if (during.config) state.restart = true;
+	state.clean = status == 0 && !changed;
+	return status;
+}
+
+//-----------------------------------------------------------------------------
+// what the watcher saw since it was last read
+//-----------------------------------------------------------------------------
+void readChanges(ServerState& state) {
+	WatchEvents events;
+	state.watcher.read(events);
+	if (events.changed || !events.rootNames.empty()) state.clean = false;
+	if (events.config) state.restart = true;
+}
+
+//-----------------------------------------------------------------------------
+// one request, with the client's stdout and stderr standing in for ours
+// while it runs. once the config changed, builds are sent back to be run
+// by the client, which reads the new config itself.
+//-----------------------------------------------------------------------------
+void serveClient(ServerState& state, int sock, bool& stop) {
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &REQUEST_TIMEOUT, sizeof(REQUEST_TIMEOUT));
+	std::string data, command;
+	std::vector<int> fds;
+	BuildOptions options;
+	std::string environment;
+	bool ok = readWithFds(sock, data, fds) && decodeOptions(data, command, options, environment);
+	readChanges(state);
+
+	if (ok && command == "stop") {
+		stop = true;
+		sendFrame(sock, "0");
+	} else if (ok && command == "build" && (state.restart || environment != buildEnvironment())) {
+		sendFrame(sock, "local");
+	} else if (ok && command == "build" && fds.size() == 2) {
+		fflush(stdout);
+		int savedOut = dup(STDOUT_FILENO), savedErr = dup(STDERR_FILENO);
+		dup2(fds[0], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+
+		int status = serveBuild(state, options);
+
+		std::cout.flush();
+		std::cerr.flush();
+		fflush(stdout);
+		dup2(savedOut, STDOUT_FILENO);
+		dup2(savedErr, STDERR_FILENO);
+		close(savedOut);
+		close(savedErr);
+		sendFrame(sock, std::to_string(status));
+	}
+	for (int fd : fds) close(fd);
+	close(sock);
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// nmake server [start|stop]. without an argument the server runs in the
+// foreground, start puts it in the background. a changed config restarts
+// it so everything in it is read again.
+//-----------------------------------------------------------------------------
+int runServer(const std::vector<std::string>& args, const Project& project, const Config& config, const std::string& configPath, char* argv[]) {
+	std::string arg = args.empty() ? "" : args[0];
+	if (args.size() > 1 || (arg != "" && arg != "start" && arg != "stop")) {
+		std::cerr << "Usage: nmake server [start|stop]" << std::endl;
+		return 1;
+	}
+
+	socketPath = serverSocketPath();
+	std::string dir = std::filesystem::path(socketPath).parent_path().string();
+
+	if (arg == "stop") {
+		int sock = privateDir(dir, false) ? connectEndpoint("unix:" + socketPath, 1000) : -1;
+		std::string reply;
+		bool stopped = sock >= 0 && sendFrame(sock, std::string(SERVER_PROTOCOL) + " stop") && readFrame(sock, reply);
+		if (sock >= 0) close(sock);
+		if (!stopped) {
+			std::cerr << "No server is running for this directory." << std::endl;
+			return 1;
+		}
+		std::cout << "Server stopped." << std::endl;
+		return 0;
+	}
+
+	if (!privateDir(dir, true)) {
+		std::cerr << "Refusing to use " << dir << ", it has to be a directory only you can access." << std::endl;
+		return 1;
+	}
+	std::string error;
+	int listener = listenEndpoint("unix:" + socketPath, error);
+	if (listener < 0) {
+		std::cerr << "Can't start a server: " << error << std::endl;
+		return 1;
+	}
+
+	if (arg == "start") {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pid > 0) {
+			std::cout << "Server started (pid " << pid << "), 'nmake server stop' stops it." << std::endl;
+			return 0;
+		}
+		setsid();
+		int null = open("/dev/null", O_RDWR);
+		dup2(null, STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		if (null > STDERR_FILENO) close(null);
+	} else {
+		std::cout << "Server listening on " << socketPath << ", press Ctrl-C to stop." << std::endl;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, removeSocket);
+	signal(SIGTERM, removeSocket);
+
+	ServerState state = {project, config, FileWatcher(configPath)};
+	if (state.watcher.descriptor() < 0) {
+		perror("inotify_init1");
+		return 1;
+	}
+
+	bool stop = false;
+	while (!stop && !state.restart) {
+		struct pollfd p[2] = {{state.watcher.descriptor(), POLLIN, 0}, {listener, POLLIN, 0}};
+		if (poll(p, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+		if (p[0].revents & POLLIN) readChanges(state);
+		if (p[1].revents & POLLIN) {
+			int sock = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+			if (sock >= 0) serveClient(state, sock, stop);
+		}
+	}
+
+	close(listener);
+	unlink(socketPath.c_str());
+	if (state.restart) {
+		execv("/proc/self/exe", argv);
+		perror("execv");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "Builder.h"
+#include "Project.h"
+#include "../Config/Config.h"
+
+#include <string>
+#include <vector>
+
+std::string serverSocketPath();
+int runServer(const std::vector<std::string>& args, const Project& project, const Config& config, const std::string& configPath, char* argv[]);
+bool buildOnServer(const BuildOptions& options, int& status);
+
+#endif /* SERVER_H */
@@ -0,0 +1,117 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Steps.cpp
+// Purpose: runs the config's top level run lines and function calls
+// before the build, as jobs on the same slots the compiles use.
+//
+//===================================================================//
+
+#include "Steps.h"
+#include "Scheduler.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <map>
+
+//-----------------------------------------------------------------------------
+// a function with outputs is up to date when every output exists and none
+// is older than any input
+//-----------------------------------------------------------------------------
+static bool outputsUpToDate(const ConfigFunction& func) {
+	if (func.outputs.empty()) return false;
+
+	long long oldest = LLONG_MAX, newest = -1;
+	for (const auto& output : func.outputs) {
+		long long t = modifiedTime(output);
+		if (t < 0) return false;
+		oldest = std::min(oldest, t);
+	}
+	for (const auto& input : func.inputs) {
+		long long t = modifiedTime(input);
+		if (t < 0) return false;
+		newest = std::max(newest, t);
+	}
+	return newest <= oldest;
+}
+
+//-----------------------------------------------------------------------------
+// a function's commands, in order, stopping at the first that fails
+//-----------------------------------------------------------------------------
+static int runFunction(const ConfigFunction& func, bool force) {
+	if (!force && outputsUpToDate(func)) {
+		printOutput("'" + func.name + "' is up to date.\n");
+		return 0;
+	}
+	for (const auto& cmd : func.commands) {
+		printOutput(cmd + "\n");
+		int status = runProcess(commandArgs(cmd));
+		if (status != 0) return status;
+	}
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// every called function runs once, after the functions it depends on.
+// top level run lines keep their place in the file: each runs after
+// everything above it and before everything below it, so calls between
+// two run lines are free to run at the same time.
+//-----------------------------------------------------------------------------
+bool runSteps(const Config& config, const BuildOptions& options) {
+	std::vector<Job> jobs;
+	std::map<std::string, size_t> functionJobs;
+	std::vector<size_t> sinceRunLine;
+	int lastRunLine = -1;
+
+	std::function<size_t(const ConfigFunction&)> addFunction = [&](const ConfigFunction& func) {
+		auto it = functionJobs.find(func.name);
+		if (it != functionJobs.end()) return it->second;
+
+		Job job;
+		for (const auto& dep : func.deps) job.after.push_back(addFunction(*config.findFunction(dep)));
+		if (lastRunLine >= 0) job.after.push_back(lastRunLine);
+		job.description = "Running '" + func.name + "'";
+		job.category = "run";
+		const ConfigFunction* f = &func;
+		bool force = options.alwaysMake;
+		job.run = [f, force]() { return runFunction(*f, force); };
+		for (const auto& command : func.commands) job.command += (job.command.empty() ? "" : " && ") + command;
+
+		jobs.push_back(job);
+		sinceRunLine.push_back(jobs.size() - 1);
+		return functionJobs[func.name] = jobs.size() - 1;
+	};
+
+	for (const auto& stmt : config.statements) {
+		if (stmt.kind == STMT_CALL) {
+			addFunction(*config.findFunction(stmt.text));
+			continue;
+		}
+
+		Job job;
+		job.description = stmt.text;
+		job.category = "run";
+		job.args = commandArgs(stmt.text);
+		job.after = sinceRunLine;
+		if (lastRunLine >= 0) job.after.push_back(lastRunLine);
+		jobs.push_back(job);
+		lastRunLine = jobs.size() - 1;
+		sinceRunLine.clear();
+	}
+
+	if (jobs.empty()) return true;
+	bool ok = runJobs(jobs, options.jobs, options.keepGoing, options.maxLoad);
+	if (options.explainSchedule) explainSchedule(jobs, options.jobs);
+	return ok;
+}
+
+bool runCall(const Config& config, const std::string& name, const BuildOptions& options) {
+	Config call = config;
+	call.statements = {{STMT_CALL, name, 0, 0}};
+	for (auto& func : call.functions) {
+		if (func.name == name) func.outputs.clear();
+	}
+	return runSteps(call, options);
+}
@@ -0,0 +1,13 @@
+#ifndef STEPS_H
+#define STEPS_H
+
+#include "Builder.h"
+#include "../Config/Config.h"
+
+bool runSteps(const Config& config, const BuildOptions& options);
+
+// runs one function after the ones it depends on, even if its outputs are
+// up to date
+bool runCall(const Config& config, const std::string& name, const BuildOptions& options);
+
+#endif /* STEPS_H */
@@ -0,0 +1,282 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Toolchain.cpp
+// Purpose: finds the compilers, assembler and linker and works out what
+// they are, once. the result is cached until PATH or a binary changes.
+//
+// Cache file (<cache dir>/toolchain/<key>), one "name value" per line:
+//
+//   nmake-toolchain 1
+//   dir <mtime> <path>          one per PATH entry
+//   cc.command <command>        and .path .inode .mtime .version .target
+//   ...                         .clang, for cc, cxx, as and ld
+//   cc.flag <flag>              one per flag the tool took when probed
+//   fastlinker <mold|lld>
+//
+//===================================================================//
+
+#include "Toolchain.h"
+#include "Cache.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/HashUtils.h"
+#include "../Utils/ProcessUtils.h"
+#include "../Utils/StringUtils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* TOOLCHAIN_MAGIC = "nmake-toolchain 2";
+
+std::string Tool::identity() const {
+	return command + "\n" + path + ":" + std::to_string(inode) + ":" + std::to_string(mtime) + "\n" + version + "\n" + target;
+}
+
+bool Tool::accepts(const std::string& flag) const {
+	return std::find(flags.begin(), flags.end(), flag) != flags.end();
+}
+
+//-----------------------------------------------------------------------------
+// the flag LTO adds, split across jobs the way each compiler does it
+//-----------------------------------------------------------------------------
+std::string ltoFlag(const Tool& tool) {
+	return tool.clang ? "-flto=thin" : "-flto=auto";
+}
+
+//-----------------------------------------------------------------------------
+// what compiles a header into a precompiled one
+//-----------------------------------------------------------------------------
+std::string pchFlag() {
+	return "-x c++-header";
+}
+
+//-----------------------------------------------------------------------------
+// the tool's command with more arguments, through the shell only when the
+// command itself needs one
+//-----------------------------------------------------------------------------
+static std::vector<std::string> toolArgs(const std::string& command, const std::vector<std::string>& extra) {
+	if (needsShell(command)) return {"/bin/sh", "-c", command + " " + joinArgs(extra)};
+	std::vector<std::string> args = splitArgs(command);
+	args.insert(args.end(), extra.begin(), extra.end());
+	return args;
+}
+
+//-----------------------------------------------------------------------------
+// what the tool prints with these arguments, for the one-off probes
+//-----------------------------------------------------------------------------
+static std::string capture(const std::string& command, const std::vector<std::string>& extra) {
+	OutputCapture output;
+	setOutputCapture(&output);
+	int status = runProcess(toolArgs(command, extra));
+	setOutputCapture(nullptr);
+	return status == 0 ? output.text : "";
+}
+
+//-----------------------------------------------------------------------------
+// the command's binary, found through PATH unless it has a slash in it
+//-----------------------------------------------------------------------------
+static std::string binaryPath(const std::string& command) {
+	std::vector<std::string> words = splitArgs(command);
+	if (words.empty()) return "";
+	if (words[0].find('/') != std::string::npos) return words[0];
+	std::vector<std::string> paths = findExecutables(words[0]);
+	return paths.empty() ? "" : paths[0];
+}
+
+static void probeTool(Tool& tool, bool compiler) {
+	tool.path = binaryPath(tool.command);
+	struct stat st;
+	if (!tool.path.empty() && stat(tool.path.c_str(), &st) == 0) {
+		tool.inode = st.st_ino;
+		tool.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	}
+
+	std::string version = capture(tool.command, {"--version"});
+	tool.version = trim(version.substr(0, version.find('\n')));
+	tool.clang = version.find("clang") != std::string::npos;
+	if (compiler) tool.target = trim(capture(tool.command, {"-dumpmachine"}));
+}
+
+//-----------------------------------------------------------------------------
+// whether the tool compiles (or with link, links) an empty program with
+// flag. dir is somewhere to put the files.
+//-----------------------------------------------------------------------------
+static bool probeFlag(const Tool& tool, const std::string& flag, bool link, const std::string& dir) {
+	std::string source = dir + "/probe.c", output = dir + "/probe.out";
+	if (!writeFile(source, "int main(void) { return 0; }\n")) return false;
+	std::vector<std::string> args = splitArgs(flag);
+	if (!link) args.push_back("-c");
+	args.insert(args.end(), {source, "-o", output});
+	bool ok = runProcess(toolArgs(tool.command, args), true) == 0;
+	unlink(output.c_str());
+	return ok;
+}
+
+//-----------------------------------------------------------------------------
+// tries the flags the build may add to each tool's commands: LTO, the
+// precompiled header, and the fast linkers. the linker driver looks for
+// ld.<name>, and an old one may not know mold.
+//-----------------------------------------------------------------------------
+static void probeFlags(Toolchain& toolchain) {
+	char dir[] = "/tmp/nmake-probe-XXXXXX";
+	if (!mkdtemp(dir)) return;
+
+	for (Tool* tool : {&toolchain.cc, &toolchain.cxx}) {
+		if (probeFlag(*tool, ltoFlag(*tool), false, dir)) tool->flags.push_back(ltoFlag(*tool));
+	}
+	if (probeFlag(toolchain.cxx, pchFlag(), false, dir)) toolchain.cxx.flags.push_back(pchFlag());
+	if (probeFlag(toolchain.ld, ltoFlag(toolchain.ld), true, dir)) toolchain.ld.flags.push_back(ltoFlag(toolchain.ld));
+	for (const auto& linker : {std::make_pair("ld.mold", "mold"), std::make_pair("ld.lld", "lld")}) {
+		std::string flag = std::string("-fuse-ld=") + linker.second;
+		if (!findExecutables(linker.first).empty() && probeFlag(toolchain.ld, flag, true, dir)) {
+			toolchain.ld.flags.push_back(flag);
+			if (toolchain.fastLinker.empty()) toolchain.fastLinker = linker.second;
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::remove_all(dir, ec);
+}
+
+//-----------------------------------------------------------------------------
+// fills in a compiler the config didn't set: $env, then first, then second
+//-----------------------------------------------------------------------------
+static bool resolveCommand(std::string& comp, const char* env, const char* first, const char* second, const char* what) {
+	if (!comp.empty()) return true;
+	if (!getEnvVar(env).empty()) {
+		comp = getEnvVar(env);
+		return true;
+	}
+
+	std::vector<std::string> paths = findExecutables(first);
+	if (paths.empty()) paths = findExecutables(second);
+	if (paths.empty()) {
+		std::cerr << "No " << what << " found. Please declare " << env << "." << std::endl;
+		return false;
+	}
+	comp = paths[0];
+	return true;
+}
+
+static void saveToolchain(const std::string& path, const std::vector<std::string>& dirs, const Toolchain& toolchain) {
+	std::string text = std::string(TOOLCHAIN_MAGIC) + "\n";
+	for (const auto& dir : dirs) text += "dir " + std::to_string(modifiedTime(dir)) + " " + dir + "\n";
+	for (const auto& entry : {std::make_pair("cc", &toolchain.cc), std::make_pair("cxx", &toolchain.cxx), std::make_pair("as", &toolchain.as), std::make_pair("ld", &toolchain.ld)}) {
+		std::string name = entry.first;
+		const Tool& tool = *entry.second;
+		text += name + ".command " + tool.command + "\n";
+		text += name + ".path " + tool.path + "\n";
+		text += name + ".inode " + std::to_string(tool.inode) + "\n";
+		text += name + ".mtime " + std::to_string(tool.mtime) + "\n";
+		text += name + ".version " + tool.version + "\n";
+		text += name + ".target " + tool.target + "\n";
+		text += name + ".clang " + (tool.clang ? "1" : "0") + "\n";
+		for (const auto& flag : tool.flags) text += name + ".flag " + flag + "\n";
+	}
+	text += "fastlinker " + toolchain.fastLinker + "\n";
+
+	std::string tmp = path + "." + std::to_string(getpid());
+	if (writeFile(tmp, text)) rename(tmp.c_str(), path.c_str());
+}
+
+//-----------------------------------------------------------------------------
+// reads a cached toolchain back, false unless every PATH directory and every
+// binary is exactly as it was when it was probed
+//-----------------------------------------------------------------------------
+static bool loadToolchain(const std::string& path, Toolchain& toolchain) {
+	std::istringstream in(readFile(path));
+	std::string line;
+	if (!std::getline(in, line) || line != TOOLCHAIN_MAGIC) return false;
+
+	std::map<std::string, std::string> values;
+	std::map<std::string, std::vector<std::string>> flags;
+	while (std::getline(in, line)) {
+		size_t space = line.find(' ');
+		std::string name = line.substr(0, space), value = space == std::string::npos ? "" : line.substr(space + 1);
+		if (name.size() > 5 && name.compare(name.size() - 5, 5, ".flag") == 0) {
+			flags[name.substr(0, name.size() - 5)].push_back(value);
+		} else if (name == "dir") {
+			size_t split = value.find(' ');
+			if (split == std::string::npos || value.substr(0, split) != std::to_string(modifiedTime(value.substr(split + 1)))) return false;
+		} else {
+			values[name] = value;
+		}
+	}
+	if (!values.count("fastlinker")) return false;
+
+	for (const auto& entry : {std::make_pair("cc", &toolchain.cc), std::make_pair("cxx", &toolchain.cxx), std::make_pair("as", &toolchain.as), std::make_pair("ld", &toolchain.ld)}) {
+		std::string name = entry.first;
+		Tool& tool = *entry.second;
+		tool.command = values[name + ".command"];
+		tool.path = values[name + ".path"];
+		tool.inode = atoll(values[name + ".inode"].c_str());
+		tool.mtime = atoll(values[name + ".mtime"].c_str());
+		tool.version = values[name + ".version"];
+		tool.target = values[name + ".target"];
+		tool.clang = values[name + ".clang"] == "1";
+		tool.flags = flags[name];
+
+		struct stat st;
+		long long mtime = -1, inode = -1;
+		if (!tool.path.empty() && stat(tool.path.c_str(), &st) == 0) {
+			inode = st.st_ino;
+			mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+		}
+		if (tool.command.empty() || inode != tool.inode || mtime != tool.mtime) return false;
+	}
+	toolchain.fastLinker = values["fastlinker"];
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// fills in CC, CXX, AS and LD and probes what they are. the answer is cached
+// on the config's and environment's choices plus PATH, so usually this is a
+// file read and a stat per PATH entry and binary, with no PATH search.
+//-----------------------------------------------------------------------------
+bool resolveToolchain(Project& project, Toolchain& toolchain) {
+	std::string pathEnv = getEnvVar("PATH");
+	Hasher h;
+	h.update(TOOLCHAIN_MAGIC);
+	for (const auto& value : {project.cc, project.cxx, project.as, project.ld, getEnvVar("CC"), getEnvVar("CXX"), getEnvVar("AS"), pathEnv}) h.update(value);
+	std::string dir = defaultCacheDir() + "/toolchain";
+	std::string path = dir + "/" + h.hex();
+
+	if (!loadToolchain(path, toolchain)) {
+		toolchain = Toolchain();
+		toolchain.cc.command = project.cc;
+		toolchain.cxx.command = project.cxx;
+		toolchain.as.command = project.as;
+		toolchain.ld.command = project.ld.empty() ? "g++" : project.ld;
+		if (!resolveCommand(toolchain.cc.command, "CC", "gcc", "clang", "C compiler")) return false;
+		if (!resolveCommand(toolchain.cxx.command, "CXX", "g++", "clang++", "C++ compiler")) return false;
+		if (!resolveCommand(toolchain.as.command, "AS", "nasm", "as", "assembler")) return false;
+
+		probeTool(toolchain.cc, true);
+		probeTool(toolchain.cxx, true);
+		probeTool(toolchain.as, false);
+		probeTool(toolchain.ld, true);
+		probeFlags(toolchain);
+
+		// Without a cache directory it's probed again next time.
+		std::error_code ec;
+		std::filesystem::create_directories(dir, ec);
+		if (!ec) saveToolchain(path, split(pathEnv, ':'), toolchain);
+	}
+
+	project.cc = toolchain.cc.command;
+	project.cxx = toolchain.cxx.command;
+	project.as = toolchain.as.command;
+
+	// Without an LD we link through g++, with the fast linker if there is one.
+	if (project.ld.empty()) {
+		project.ld = toolchain.ld.command;
+		if (!toolchain.fastLinker.empty() && project.ldFlags.find("-fuse-ld=") == std::string::npos)
+			project.ldFlags = "-fuse-ld=" + toolchain.fastLinker + (project.ldFlags.empty() ? "" : " " + project.ldFlags);
+	}
+	return true;
+}
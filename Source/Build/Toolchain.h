@@ -0,0 +1,32 @@
+#ifndef TOOLCHAIN_H
+#define TOOLCHAIN_H
+
+#include "Project.h"
+
+#include <string>
+#include <vector>
+
+// what we know about one program the build runs
+struct Tool {
+	std::string command; // as it's run, maybe with arguments
+	std::string path;    // the binary that resolved to
+	long long inode = -1, mtime = -1;
+	std::string version; // first line of --version
+	std::string target;  // -dumpmachine, compilers only
+	bool clang = false;
+	std::vector<std::string> flags; // of the ones the build may add, those it takes
+
+	std::string identity() const;
+	bool accepts(const std::string& flag) const;
+};
+
+struct Toolchain {
+	Tool cc, cxx, as, ld;
+	std::string fastLinker; // mold or lld, if the linker driver can use it
+};
+
+std::string ltoFlag(const Tool& tool);
+std::string pchFlag();
+bool resolveToolchain(Project& project, Toolchain& toolchain);
+
+#endif /* TOOLCHAIN_H */
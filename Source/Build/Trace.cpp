@@ -0,0 +1,145 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Trace.cpp
+// Purpose: records what the build spent its time on, and writes it out
+// as Chrome trace event JSON (chrome://tracing, ui.perfetto.dev).
+//
+// Slot 0 is nmake itself, slots 1..N are the job slots.
+//
+//===================================================================//
+
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+struct TraceEvent {
+	std::string name;
+	const char* category;
+	int slot;
+	long long start, end;
+	bool job;
+	std::string command;
+	int status;
+};
+
+struct TraceState {
+	bool enabled = false;
+	std::string path;
+	std::chrono::steady_clock::time_point origin;
+	std::mutex lock;
+	std::vector<TraceEvent> events;
+};
+
+TraceState& state() {
+	static TraceState s;
+	return s;
+}
+
+std::string escape(const std::string& str) {
+	std::string out;
+	for (unsigned char c : str) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else out += c;
+	}
+	return out;
+}
+
+void writeTrace() {
+	TraceState& s = state();
+	std::lock_guard<std::mutex> guard(s.lock);
+
+	FILE* f = fopen(s.path.c_str(), "w");
+	if (!f) {
+		fprintf(stderr, "nmake: can't write trace to %s\n", s.path.c_str());
+		return;
+	}
+
+	int pid = getpid();
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"nmake\"}}", pid);
+
+	std::set<int> slots = {0};
+	for (const auto& e : s.events) slots.insert(e.slot);
+	for (int slot : slots) {
+		std::string name = slot == 0 ? "nmake" : "slot " + std::to_string(slot);
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid, slot, name.c_str());
+		fprintf(f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}", pid, slot, slot);
+	}
+
+	for (const auto& e : s.events) {
+		fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+			escape(e.name).c_str(), e.category, pid, e.slot, e.start, e.end - e.start);
+		if (e.job)
+			fprintf(f, ",\"args\":{\"command\":\"%s\",\"status\":%d}", escape(e.command).c_str(), e.status);
+		fprintf(f, "}");
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// turns tracing on. the file is written when nmake exits, however it exits.
+//-----------------------------------------------------------------------------
+bool traceStart(const std::string& path) {
+	TraceState& s = state();
+	s.path = path;
+	s.origin = std::chrono::steady_clock::now();
+	s.enabled = true;
+	return atexit(writeTrace) == 0;
+}
+
+bool traceEnabled() {
+	return state().enabled;
+}
+
+//-----------------------------------------------------------------------------
+// microseconds since tracing started
+//-----------------------------------------------------------------------------
+long long traceNow() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - state().origin).count();
+}
+
+void traceEvent(const std::string& name, const char* category, int slot, long long start, long long end) {
+	TraceState& s = state();
+	if (!s.enabled) return;
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.events.push_back({name, category, slot, start, end, false, "", 0});
+}
+
+//-----------------------------------------------------------------------------
+// a job that ran on a slot, with what it ran and its exit status
+//-----------------------------------------------------------------------------
+void traceJob(const std::string& name, const char* category, int slot, long long start, long long end, const std::string& command, int status) {
+	TraceState& s = state();
+	if (!s.enabled) return;
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.events.push_back({name, category, slot, start, end, true, command, status});
+}
+
+TracePhase::TracePhase(const char* name) : name(name), start(traceEnabled() ? traceNow() : 0), done(false) {}
+
+TracePhase::~TracePhase() {
+	end();
+}
+
+void TracePhase::end() {
+	if (done) return;
+	done = true;
+	if (traceEnabled()) traceEvent(name, "nmake", 0, start, traceNow());
+}
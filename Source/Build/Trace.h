@@ -0,0 +1,26 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+bool traceStart(const std::string& path);
+bool traceEnabled();
+long long traceNow();
+void traceEvent(const std::string& name, const char* category, int slot, long long start, long long end);
+void traceJob(const std::string& name, const char* category, int slot, long long start, long long end, const std::string& command, int status);
+
+// records a phase of nmake itself, from construction to end() or
+// destruction, whichever comes first
+class TracePhase {
+public:
+	TracePhase(const char* name);
+	~TracePhase();
+	void end();
+
+private:
+	const char* name;
+	long long start;
+	bool done;
+};
+
+#endif /* TRACE_H */
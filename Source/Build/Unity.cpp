@@ -0,0 +1,106 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Unity.cpp
+// Purpose: groups sources into generated batch files for unity builds.
+//
+//===================================================================//
+
+#include "Unity.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/HashUtils.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <set>
+
+//-----------------------------------------------------------------------------
+// whether a batch ends after this file. it's decided by the file's own path,
+// not its position, so adding or removing a file only changes the batch it's
+// in (or splits or joins two). batches come out batchSize files long on
+// average, and at most twice that.
+//-----------------------------------------------------------------------------
+static bool endsBatch(const std::string& source, size_t filled, int batchSize) {
+	if (filled >= (size_t)batchSize * 2) return true;
+	Hasher h;
+	h.update(source);
+	uint64_t a, b;
+	h.finish(a, b);
+	return a % batchSize == 0;
+}
+
+//-----------------------------------------------------------------------------
+// batches sources per directory and language, in sorted order so the same
+// tree always gives the same batches. a batch is named after its first file,
+// and its file is only rewritten when what it includes changes, so an edit
+// or a file added or removed rebuilds just the batch it's in. batch files
+// left from files that moved to other batches are removed. anything that
+// can't be batched comes back as a unit of its own.
+//-----------------------------------------------------------------------------
+std::vector<CompileUnit> unityBatches(const std::vector<CompileStep>& steps, const std::string& buildDir, int batchSize) {
+	std::vector<CompileUnit> units;
+	std::map<std::pair<std::string, std::string>, std::vector<CompileStep>> groups;
+	for (const auto& step : steps) {
+		// No depfile means assembly, which can't be included into C.
+		if (step.depFile.empty()) {
+			units.push_back({step});
+			continue;
+		}
+		std::filesystem::path object = std::filesystem::path(step.object).lexically_relative(buildDir);
+		std::string lang = std::filesystem::path(step.source).extension() == ".c" ? "c" : "cpp";
+		groups[{object.parent_path().string(), lang}].push_back(step);
+	}
+
+	if (batchSize < 1) batchSize = 1;
+	std::string unityDir = (std::filesystem::path(buildDir) / ".nmake/unity").lexically_normal().string();
+	std::set<std::string> dirs, kept;
+	for (auto& group : groups) {
+		std::vector<CompileStep>& members = group.second;
+		std::sort(members.begin(), members.end(), [](const CompileStep& a, const CompileStep& b) { return a.source < b.source; });
+		std::string dir = (std::filesystem::path(unityDir) / group.first.first).lexically_normal().string();
+		dirs.insert(dir);
+
+		size_t first = 0;
+		for (size_t i = 0; i < members.size(); i++) {
+			if (i + 1 < members.size() && !endsBatch(members[i].source, i + 1 - first, batchSize)) continue;
+			size_t last = i + 1;
+			size_t start = first;
+			first = last;
+			if (last - start == 1) {
+				units.push_back({members[start]});
+				continue;
+			}
+
+			CompileUnit unit;
+			unit.members.assign(members.begin() + start, members.begin() + last);
+			unit.step = members[start];
+			std::string name = "batch-" + hashString(members[start].source).substr(0, 16) + "." + group.first.second;
+			unit.step.source = (std::filesystem::path(dir) / name).lexically_normal().string();
+			unit.step.object = unit.step.source + ".o";
+			unit.step.depFile = unit.step.object + ".d";
+			kept.insert({unit.step.source, unit.step.object, unit.step.depFile});
+
+			std::string text = "// generated by nmake for a unity build, do not edit\n";
+			for (const auto& member : unit.members)
+				text += "#include \"" + std::filesystem::absolute(member.source).lexically_normal().string() + "\"\n";
+			if (readFile(unit.step.source) != text) {
+				if (!writeFile(unit.step.source, text)) {
+					for (const auto& member : unit.members) units.push_back({member});
+					continue;
+				}
+				unit.changed = true;
+			}
+			units.push_back(unit);
+		}
+	}
+
+	std::error_code ec;
+	for (const auto& dir : dirs) {
+		for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+			std::string path = entry.path().lexically_normal().string();
+			if (entry.is_regular_file(ec) && entry.path().filename().string().compare(0, 5, "batch") == 0 && !kept.count(path))
+				std::filesystem::remove(entry.path(), ec);
+		}
+	}
+	return units;
+}
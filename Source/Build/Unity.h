@@ -0,0 +1,19 @@
+#ifndef UNITY_H
+#define UNITY_H
+
+#include "Compile.h"
+
+#include <string>
+#include <vector>
+
+// what one compile job builds: a source, or in unity builds a generated
+// file that #includes several of them
+struct CompileUnit {
+	CompileStep step;
+	std::vector<CompileStep> members; // empty unless this is a batch
+	bool changed = false;             // the batch file was (re)written
+};
+
+std::vector<CompileUnit> unityBatches(const std::vector<CompileStep>& steps, const std::string& buildDir, int batchSize);
+
+#endif /* UNITY_H */
@@ -0,0 +1,168 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Watch.cpp
+// Purpose: nmake watch, rebuilds whenever a source, a header or the
+// config changes.
+//
+//===================================================================//
+
+#include "Watch.h"
+#include "Graph.h"
+#include "Steps.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <set>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+static const uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB | IN_ONLYDIR;
+
+// how long things have to be quiet after a change before we build
+static const int DEBOUNCE_MS = 100;
+
+static std::string normalPath(const std::string& path) {
+	std::string normal = std::filesystem::absolute(path.empty() ? "." : path).lexically_normal().string();
+	while (normal.size() > 1 && normal.back() == '/') normal.pop_back();
+	return normal;
+}
+
+//-----------------------------------------------------------------------------
+// editors write swap and backup files next to what they're saving
+//-----------------------------------------------------------------------------
+static bool ignoredName(const std::string& name) {
+	if (name.empty() || name[0] == '.' || name[0] == '#' || name.back() == '~') return true;
+	std::string ext = std::filesystem::path(name).extension().string();
+	return ext == ".swp" || ext == ".swx" || ext == ".tmp" || name == "4913";
+}
+
+FileWatcher::FileWatcher(const std::string& configPath) {
+	fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	root = normalPath(std::filesystem::path(configPath).parent_path().string());
+	configName = std::filesystem::path(configPath).filename().string();
+}
+
+FileWatcher::~FileWatcher() {
+	if (fd >= 0) close(fd);
+}
+
+//-----------------------------------------------------------------------------
+// watches every directory the last build read from outside the build
+// directory: the source tree and wherever headers came from, plus the
+// config's. adding a watch twice is harmless, so this runs after every
+// build to pick up new directories.
+//-----------------------------------------------------------------------------
+void FileWatcher::addWatches(const BuildGraph& graph, const Project& project) {
+	std::string buildDir = normalPath(project.buildDir);
+	output = normalPath(project.output);
+	std::set<std::string> wanted = {normalPath(project.sourceDir)};
+	for (const auto& node : graph.nodes) {
+		if (node.kind == NODE_DIR) wanted.insert(normalPath(node.path));
+		else if (node.kind == NODE_SOURCE || node.kind == NODE_HEADER) wanted.insert(normalPath(std::filesystem::path(node.path).parent_path().string()));
+	}
+
+	for (const auto& dir : wanted) {
+		if (dir == buildDir || dir.compare(0, buildDir.size() + 1, buildDir + "/") == 0) continue;
+		int wd = inotify_add_watch(fd, dir.c_str(), WATCH_EVENTS);
+		if (wd >= 0) dirs[wd] = {dir, false};
+	}
+	if (!wanted.count(root)) {
+		int wd = inotify_add_watch(fd, root.c_str(), WATCH_EVENTS);
+		if (wd >= 0) dirs[wd] = {root, true};
+	}
+}
+
+//-----------------------------------------------------------------------------
+// everything queued up, without waiting. the build's own output doesn't
+// count as a change, except in rootNames.
+//-----------------------------------------------------------------------------
+void FileWatcher::read(WatchEvents& events) {
+	alignas(struct inotify_event) char buf[65536];
+	while (true) {
+		ssize_t len = ::read(fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR) continue;
+		if (len <= 0) return;
+
+		for (ssize_t i = 0; i < len;) {
+			struct inotify_event* event = (struct inotify_event*)(buf + i);
+			i += sizeof(struct inotify_event) + event->len;
+
+			// Lost events or a directory going away, build to be safe.
+			if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+				if (event->mask & IN_IGNORED) dirs.erase(event->wd);
+				events.changed = true;
+				continue;
+			}
+
+			auto dir = dirs.find(event->wd);
+			if (dir == dirs.end()) continue;
+			std::string name = event->len ? event->name : "";
+			// .nmakeignore changes what the scan finds, it counts as config
+			// even though it's a dotfile.
+			if (dir->second.path == root && (name == configName || name == ".nmakeignore")) {
+				events.config = true;
+			} else if (dir->second.path == root && !ignoredName(name)) {
+				events.rootNames.push_back(name);
+				if (!dir->second.configOnly && root + "/" + name != output) events.changed = true;
+			} else if (!dir->second.configOnly && !ignoredName(name) && dir->second.path + "/" + name != output) {
+				events.changed = true;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// runs the config's steps and builds, then waits for a change and does it
+// again, forever. the graph stays in memory between builds. a changed
+// config restarts nmake so everything it says is read again.
+//-----------------------------------------------------------------------------
+int watch(const Project& project, const Config& config, const BuildOptions& options, const std::string& configPath, char* argv[]) {
+	FileWatcher watcher(configPath);
+	if (watcher.descriptor() < 0) {
+		perror("inotify_init1");
+		return 1;
+	}
+
+	BuildGraph graph;
+	while (true) {
+		// What the steps generate is picked up by the build that follows,
+		// it's not a change to build again for.
+		bool stepsOk = runSteps(config, options);
+		WatchEvents events;
+		watcher.read(events);
+		bool configChanged = events.config;
+
+		// build() fills in compilers and flags, start from the config each time
+		Project current = project;
+		if (stepsOk) build(current, options, &graph);
+		else std::cerr << "Build failed." << std::endl;
+		watcher.addWatches(graph, current);
+		std::cout << "Watching for changes, press Ctrl-C to stop." << std::endl;
+
+		// Wait for a change that matters, then until the burst of saves is over.
+		events = WatchEvents();
+		events.config = configChanged;
+		while (true) {
+			struct pollfd p = {watcher.descriptor(), POLLIN, 0};
+			int n = poll(&p, 1, events.changed || events.config ? DEBOUNCE_MS : -1);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) {
+				perror("poll");
+				return 1;
+			}
+			if (n == 0) break;
+			watcher.read(events);
+		}
+
+		if (events.config) {
+			std::cout << "The config or .nmakeignore changed, restarting." << std::endl;
+			execv("/proc/self/exe", argv);
+			perror("execv");
+			return 1;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "Builder.h"
+#include "Graph.h"
+#include "Project.h"
+#include "../Config/Config.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// what changed since the last FileWatcher::read
+struct WatchEvents {
+	bool changed = false;               // a source, a header or a directory of them
+	bool config = false;                // the config file or .nmakeignore
+	std::vector<std::string> rootNames; // anything else next to the config
+};
+
+// inotify on the directories the last build read from
+class FileWatcher {
+public:
+	FileWatcher(const std::string& configPath);
+	~FileWatcher();
+
+	int descriptor() const { return fd; }
+	void addWatches(const BuildGraph& graph, const Project& project);
+	void read(WatchEvents& events);
+
+private:
+	struct WatchedDir {
+		std::string path;
+		bool configOnly; // the project root, only the config in it matters
+	};
+
+	int fd;
+	std::string root, configName, output;
+	std::map<int, WatchedDir> dirs;
+};
+
+int watch(const Project& project, const Config& config, const BuildOptions& options, const std::string& configPath, char* argv[]);
+
+#endif /* WATCH_H */
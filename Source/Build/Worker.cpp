@@ -0,0 +1,222 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Worker.cpp
+// Purpose: nmake worker, compiles preprocessed sources other nmakes send
+// it and sends back the objects.
+//
+//===================================================================//
+
+#include "Remote.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/ProcessUtils.h"
+#include "../Utils/StringUtils.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+std::mutex lock;
+int active = 0;
+std::map<std::string, std::string> compilers;  // name a client gives -> binary here
+std::map<std::string, std::string> toolchains; // binary -> "version\ntarget"
+
+std::string baseName(const std::string& command) {
+	return command.substr(command.find_last_of('/') + 1);
+}
+
+//-----------------------------------------------------------------------------
+// only compiler drivers are run, whatever a client asks for: gcc, g++, cc,
+// c++, clang and clang++, maybe with a target prefix or version suffix
+//-----------------------------------------------------------------------------
+bool isCompiler(const std::string& command) {
+	std::string name = baseName(command);
+	size_t dash = name.find_last_of('-');
+	if (dash != std::string::npos && name.find_first_not_of("0123456789.", dash + 1) == std::string::npos) name.erase(dash);
+	dash = name.find_last_of('-');
+	if (dash != std::string::npos) name = name.substr(dash + 1);
+	return name == "gcc" || name == "g++" || name == "cc" || name == "c++" || name == "clang" || name == "clang++";
+}
+
+//-----------------------------------------------------------------------------
+// the compilers this worker runs, each found here once at startup: the ones
+// given with --compiler, or else the usual drivers in PATH. a client's
+// compiler is only ever matched to one of these by name.
+//-----------------------------------------------------------------------------
+bool findCompilers(const std::vector<std::string>& given) {
+	std::vector<std::string> names = given;
+	if (names.empty()) names = {"gcc", "g++", "cc", "c++", "clang", "clang++"};
+	for (const auto& name : names) {
+		std::vector<std::string> paths = name.find('/') != std::string::npos ? std::vector<std::string>{name} : findExecutables(name);
+		// Absolute, but not through the symlinks: gcc names itself after
+		// argv[0] in --version, which has to match the client's.
+		std::error_code ec;
+		std::string path = paths.empty() ? "" : std::filesystem::absolute(paths[0], ec).string();
+		if (!given.empty() && (path.empty() || ec || access(path.c_str(), X_OK) != 0 || !isCompiler(name))) {
+			std::cerr << "Not a compiler this worker can run: " << name << std::endl;
+			return false;
+		}
+		if (!path.empty() && !ec) compilers[baseName(name)] = path;
+	}
+	return !compilers.empty();
+}
+
+std::string firstLine(const std::vector<std::string>& args) {
+	OutputCapture output;
+	setOutputCapture(&output);
+	int status = runProcess(args);
+	setOutputCapture(nullptr);
+	if (status != 0) return "";
+	return trim(output.text.substr(0, output.text.find('\n')));
+}
+
+//-----------------------------------------------------------------------------
+// what the client's toolchain string would be for this compiler here,
+// looked up once per compiler
+//-----------------------------------------------------------------------------
+std::string toolchainOf(const std::string& compiler) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto it = toolchains.find(compiler);
+		if (it != toolchains.end()) return it->second;
+	}
+	std::string toolchain = firstLine({compiler, "--version"}) + "\n" + firstLine({compiler, "-dumpmachine"});
+	std::lock_guard<std::mutex> guard(lock);
+	return toolchains[compiler] = toolchain;
+}
+
+CompileReply compile(const CompileRequest& request) {
+	CompileReply reply;
+	reply.kind = "refused";
+	auto compiler = request.args.empty() ? compilers.end() : compilers.find(baseName(request.args[0]));
+	if (compiler == compilers.end() || (request.language != "c" && request.language != "c++")) {
+		reply.diagnostics = "not a compiler this worker runs";
+		return reply;
+	}
+	for (size_t i = 1; i < request.args.size(); i++) {
+		if (!remoteFlagAllowed(request.args[i])) {
+			reply.diagnostics = "flag this worker doesn't run: " + request.args[i];
+			return reply;
+		}
+	}
+	if (toolchainOf(compiler->second) != request.toolchain) {
+		reply.diagnostics = "different compiler version or target";
+		return reply;
+	}
+
+	char dir[] = "/tmp/nmake-worker-XXXXXX";
+	if (!mkdtemp(dir)) return reply;
+	std::string source = std::string(dir) + (request.language == "c" ? "/in.i" : "/in.ii");
+	std::string object = std::string(dir) + "/out.o";
+
+	if (writeFile(source, request.source)) {
+		std::vector<std::string> args = request.args;
+		args[0] = compiler->second;
+		args.insert(args.end(), {"-c", source, "-o", object});
+		OutputCapture output;
+		setOutputCapture(&output);
+		int status = runProcess(args);
+		setOutputCapture(nullptr);
+
+		reply.kind = "done";
+		reply.exitCode = exitCode(status);
+		reply.diagnostics = output.text;
+		if (status == 0) reply.object = readFile(object);
+	}
+
+	std::error_code ec;
+	std::filesystem::remove_all(dir, ec);
+	return reply;
+}
+
+// a client that connected and went quiet gives its slot back after this
+const timeval REQUEST_TIMEOUT = {30, 0};
+
+void serve(int fd) {
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &REQUEST_TIMEOUT, sizeof(REQUEST_TIMEOUT));
+	std::string data;
+	CompileRequest request;
+	if (sendFrame(fd, "ready") && readFrame(fd, data)) {
+		if (decodeRequest(data, request)) {
+			CompileReply reply = compile(request);
+			sendFrame(fd, encodeReply(reply));
+		}
+	}
+	close(fd);
+
+	std::lock_guard<std::mutex> guard(lock);
+	active--;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// nmake worker --listen <unix:/path | [host:]port> [--compiler name]...
+// runs up to slots compiles at once, a client that connects past that is
+// told it's busy and compiles the file itself.
+//-----------------------------------------------------------------------------
+int runWorker(const std::vector<std::string>& args, int slots) {
+	std::string endpoint;
+	std::vector<std::string> given;
+	for (size_t i = 0; i < args.size(); i++) {
+		if (args[i] == "--listen" && i + 1 < args.size()) {
+			endpoint = args[++i];
+		} else if (args[i] == "--compiler" && i + 1 < args.size()) {
+			given.push_back(args[++i]);
+		} else {
+			std::cerr << "Invalid worker option: " << args[i] << std::endl;
+			return 1;
+		}
+	}
+	if (endpoint.empty()) {
+		std::cerr << "Usage: nmake [-j jobs] worker --listen <unix:/path | [host:]port> [--compiler name]..." << std::endl;
+		return 1;
+	}
+	if (!findCompilers(given)) {
+		if (given.empty()) std::cerr << "No compilers found in PATH." << std::endl;
+		return 1;
+	}
+
+	std::string error;
+	int server = listenEndpoint(endpoint, error);
+	if (server < 0) {
+		std::cerr << "Can't listen on " << endpoint << ": " << error << std::endl;
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	std::cout << "Worker listening on " << endpoint << " with " << slots << " slots." << std::endl;
+	for (const auto& compiler : compilers) std::cout << "\t" << compiler.first << " -> " << compiler.second << std::endl;
+
+	while (true) {
+		int fd = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno == EMFILE || errno == ENFILE) {
+				usleep(10000); // out of descriptors until a compile finishes
+				continue;
+			}
+			perror("accept");
+			return 1;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (active >= slots) {
+				sendFrame(fd, "busy");
+				close(fd);
+				continue;
+			}
+			active++;
+		}
+		std::thread(serve, fd).detach();
+	}
+}
@@ -0,0 +1,210 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Config.cpp
+// Purpose: loads a config file, going through a cache of parsed configs
+// keyed on the file's hash so unchanged configs are never re-parsed.
+//
+//===================================================================//
+
+#include "Config.h"
+#include "Parser.h"
+#include "../Build/Cache.h"
+#include "../Utils/FileUtils.h"
+#include "../Utils/HashUtils.h"
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+
+static const char CONFIG_CACHE_MAGIC[8] = {'N', 'M', 'A', 'K', 'E', 'C', 'F', '3'};
+
+const ConfigFunction* Config::findFunction(const std::string& name) const {
+	for (const auto& func : functions) {
+		if (func.name == name) return &func;
+	}
+	return nullptr;
+}
+
+const ConfigBlock* Config::findConfiguration(const std::string& name) const {
+	for (const auto& block : configurations) {
+		if (block.name == name) return &block;
+	}
+	return nullptr;
+}
+
+static void putU32(std::string& out, uint32_t v) {
+	out.append((const char*)&v, sizeof(v));
+}
+
+static void putStr(std::string& out, const std::string& s) {
+	putU32(out, s.size());
+	out += s;
+}
+
+static void putVars(std::string& out, const std::vector<ConfigVar>& vars) {
+	putU32(out, vars.size());
+	for (const auto& var : vars) {
+		putStr(out, var.name);
+		putU32(out, var.line);
+		putU32(out, var.column);
+		putU32(out, var.value.index());
+		if (auto i = std::get_if<int>(&var.value)) putU32(out, *i);
+		else if (auto b = std::get_if<bool>(&var.value)) putU32(out, *b);
+		else putStr(out, std::get<std::string>(var.value));
+	}
+}
+
+static std::string serialize(const Config& config) {
+	std::string out(CONFIG_CACHE_MAGIC, sizeof(CONFIG_CACHE_MAGIC));
+
+	putVars(out, config.vars);
+
+	putU32(out, config.functions.size());
+	for (const auto& func : config.functions) {
+		putStr(out, func.name);
+		putU32(out, func.line);
+		putU32(out, func.column);
+		for (const auto& list : {&func.commands, &func.deps, &func.inputs, &func.outputs}) {
+			putU32(out, list->size());
+			for (const auto& item : *list) putStr(out, item);
+		}
+	}
+
+	putU32(out, config.statements.size());
+	for (const auto& stmt : config.statements) {
+		putU32(out, stmt.kind);
+		putStr(out, stmt.text);
+		putU32(out, stmt.line);
+		putU32(out, stmt.column);
+	}
+
+	putU32(out, config.configurations.size());
+	for (const auto& block : config.configurations) {
+		putStr(out, block.name);
+		putU32(out, block.line);
+		putU32(out, block.column);
+		putVars(out, block.vars);
+	}
+	return out;
+}
+
+namespace {
+
+// bounds-checked reader, any overrun just makes ok false
+struct Reader {
+	const std::string& data;
+	size_t pos = 0;
+	bool ok = true;
+
+	uint32_t u32() {
+		uint32_t v = 0;
+		if (pos + sizeof(v) > data.size()) {
+			ok = false;
+			return 0;
+		}
+		memcpy(&v, data.data() + pos, sizeof(v));
+		pos += sizeof(v);
+		return v;
+	}
+
+	std::string str() {
+		uint32_t len = u32();
+		if (!ok || pos + len > data.size()) {
+			ok = false;
+			return "";
+		}
+		std::string s = data.substr(pos, len);
+		pos += len;
+		return s;
+	}
+};
+
+} // namespace
+
+static bool readVars(Reader& in, std::vector<ConfigVar>& vars) {
+	for (uint32_t n = in.u32(); in.ok && n; n--) {
+		ConfigVar var;
+		var.name = in.str();
+		var.line = in.u32();
+		var.column = in.u32();
+		uint32_t type = in.u32();
+		if (type == 0) var.value = (int)in.u32();
+		else if (type == 1) var.value = in.u32() != 0;
+		else if (type == 2) var.value = in.str();
+		else return false;
+		vars.push_back(var);
+	}
+	return in.ok;
+}
+
+static bool deserialize(const std::string& data, Config& config) {
+	if (data.size() < sizeof(CONFIG_CACHE_MAGIC) || memcmp(data.data(), CONFIG_CACHE_MAGIC, sizeof(CONFIG_CACHE_MAGIC)) != 0) return false;
+	Reader in = {data};
+	in.pos = sizeof(CONFIG_CACHE_MAGIC);
+
+	if (!readVars(in, config.vars)) return false;
+
+	for (uint32_t n = in.u32(); in.ok && n; n--) {
+		ConfigFunction func;
+		func.name = in.str();
+		func.line = in.u32();
+		func.column = in.u32();
+		for (auto list : {&func.commands, &func.deps, &func.inputs, &func.outputs}) {
+			for (uint32_t c = in.u32(); in.ok && c; c--) list->push_back(in.str());
+		}
+		config.functions.push_back(func);
+	}
+
+	for (uint32_t n = in.u32(); in.ok && n; n--) {
+		ConfigStatement stmt;
+		uint32_t kind = in.u32();
+		if (kind > STMT_CALL) return false;
+		stmt.kind = (StatementKind)kind;
+		stmt.text = in.str();
+		stmt.line = in.u32();
+		stmt.column = in.u32();
+		config.statements.push_back(stmt);
+	}
+
+	for (uint32_t n = in.u32(); in.ok && n; n--) {
+		ConfigBlock block;
+		block.name = in.str();
+		block.line = in.u32();
+		block.column = in.u32();
+		if (!readVars(in, block.vars)) return false;
+		config.configurations.push_back(block);
+	}
+
+	return in.ok && in.pos == data.size();
+}
+
+//-----------------------------------------------------------------------------
+// reads and parses the config at path. error is "file:line:col: error: ..."
+// when the file doesn't parse.
+//-----------------------------------------------------------------------------
+bool loadConfig(const std::string& path, Config& config, std::string& error) {
+	if (access(path.c_str(), R_OK) != 0) {
+		error = "Failed to find a config file at: " + path;
+		return false;
+	}
+	std::string source = readFile(path);
+
+	config = Config();
+	config.path = path;
+	config.hash = hashString(source);
+
+	std::string cachePath = defaultCacheDir() + "/config/" + config.hash;
+	if (deserialize(readFile(cachePath), config)) return true;
+
+	config = Config();
+	config.path = path;
+	config.hash = hashString(source);
+	if (!parseConfig(source, config, error)) return false;
+
+	// temp file and rename, another nmake may be reading the same entry
+	std::string tmp = cachePath + ".tmp" + std::to_string(getpid());
+	if (writeFile(tmp, serialize(config))) rename(tmp.c_str(), cachePath.c_str());
+	else unlink(tmp.c_str());
+	return true;
+}
@@ -0,0 +1,58 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <variant>
+#include <vector>
+
+typedef std::variant<int, bool, std::string> ConfigValue;
+
+struct ConfigVar {
+	std::string name;
+	ConfigValue value;
+	int line, column;
+};
+
+struct ConfigFunction {
+	std::string name;
+	std::vector<std::string> commands;
+	std::vector<std::string> deps;            // functions that run first
+	std::vector<std::string> inputs, outputs; // skipped when outputs are newer
+	int line, column;
+};
+
+enum StatementKind {
+	STMT_RUN,
+	STMT_CALL,
+};
+
+// top level run lines and function calls, in file order
+struct ConfigStatement {
+	StatementKind kind;
+	std::string text; // the command, or the name of the called function
+	int line, column;
+};
+
+// configuration Name { ... }: settings applied on top of the top level
+// ones, built in a build directory of its own
+struct ConfigBlock {
+	std::string name;
+	std::vector<ConfigVar> vars;
+	int line, column;
+};
+
+struct Config {
+	std::string path;
+	std::string hash; // of the file contents
+	std::vector<ConfigVar> vars;
+	std::vector<ConfigFunction> functions;
+	std::vector<ConfigStatement> statements;
+	std::vector<ConfigBlock> configurations;
+
+	const ConfigFunction* findFunction(const std::string& name) const;
+	const ConfigBlock* findConfiguration(const std::string& name) const;
+};
+
+bool loadConfig(const std::string& path, Config& config, std::string& error);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,201 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Lexer.cpp
+// Purpose: splits a config file into tokens in a single pass.
+//
+//===================================================================//
+
+#include "Lexer.h"
+
+static bool isIdentChar(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static std::string lower(const std::string& word) {
+	std::string out;
+	for (char c : word) out += (c >= 'A' && c <= 'Z') ? c + 32 : c;
+	return out;
+}
+
+//-----------------------------------------------------------------------------
+// statements whose argument is the rest of the line: run anywhere, inputs
+// and outputs only inside a function so they don't take the names away
+// from variables, including ones set in a configuration block
+//-----------------------------------------------------------------------------
+static bool takesRestOfLine(const std::string& word, bool inFunction) {
+	std::string w = lower(word);
+	return w == "run" || (inFunction && (w == "inputs" || w == "outputs"));
+}
+
+Lexer::Lexer(const std::string& source) : src(source), pos(0), line(1), column(1), atStatementStart(true), wantCommand(false), statementTokens(0), lastType(TOK_NEWLINE) {}
+
+void Lexer::advance() {
+	if (src[pos] == '\n') {
+		line++;
+		column = 1;
+	} else column++;
+	pos++;
+}
+
+Token Lexer::make(TokenType type, std::string text, int l, int c) {
+	if (type == TOK_NEWLINE || type == TOK_LBRACE || type == TOK_RBRACE) {
+		statementTokens = 0;
+		firstWord.clear();
+	} else if (statementTokens++ == 0 && type == TOK_IDENT) {
+		firstWord = lower(text);
+	}
+	lastType = type;
+	return {type, std::move(text), l, c};
+}
+
+//-----------------------------------------------------------------------------
+// quoted value, may span lines. \<quote> and \\ escape, a backslash at the
+// end of a line joins it with the next, anything else is kept as written.
+//-----------------------------------------------------------------------------
+Token Lexer::lexString(char quote, int l, int c) {
+	std::string text;
+	advance();
+	while (pos < src.size()) {
+		char ch = src[pos];
+		if (ch == quote) {
+			advance();
+			return make(TOK_STRING, text, l, c);
+		}
+		if (ch == '\\' && pos + 1 < src.size()) {
+			char esc = src[pos+1];
+			if (esc == quote || esc == '\\') {
+				text += esc;
+				advance();
+				advance();
+				continue;
+			}
+			if (esc == '\n') {
+				advance();
+				advance();
+				continue;
+			}
+		}
+		text += ch;
+		advance();
+	}
+	return make(TOK_ERROR, "unterminated string", l, c);
+}
+
+//-----------------------------------------------------------------------------
+// everything up to the end of the line, verbatim. a backslash right before
+// the newline continues the command on the next line, like sh.
+//-----------------------------------------------------------------------------
+Token Lexer::lexCommand(int l, int c) {
+	std::string text;
+	while (pos < src.size() && src[pos] != '\n') {
+		if (src[pos] == '\\' && pos + 1 < src.size() && src[pos+1] == '\n') {
+			advance();
+			advance();
+			continue;
+		}
+		text += src[pos];
+		advance();
+	}
+
+	size_t end = text.find_last_not_of(" \t\r");
+	text.erase(end == std::string::npos ? 0 : end + 1);
+	if (text.empty()) return make(TOK_ERROR, commandKeyword == "run" ? "expected a command after 'run'" : "expected paths after '" + commandKeyword + "'", l, c);
+	return make(TOK_COMMAND, text, l, c);
+}
+
+Token Lexer::next() {
+	// skip blanks, comments and line continuations between tokens
+	while (pos < src.size()) {
+		char ch = src[pos];
+		if (ch == ' ' || ch == '\t' || ch == '\r') advance();
+		else if (ch == '\\' && pos + 1 < src.size() && src[pos+1] == '\n') {
+			advance();
+			advance();
+		} else if (ch == '#' && !wantCommand) {
+			while (pos < src.size() && src[pos] != '\n') advance();
+		} else break;
+	}
+
+	int l = line, c = column;
+	if (wantCommand) {
+		wantCommand = false;
+		return lexCommand(l, c);
+	}
+	if (pos >= src.size()) return make(TOK_EOF, "", l, c);
+
+	char ch = src[pos];
+	bool statementStart = atStatementStart;
+	atStatementStart = false;
+
+	switch (ch) {
+		case '\n':
+			advance();
+			atStatementStart = true;
+			return make(TOK_NEWLINE, "", l, c);
+		case '=':
+			advance();
+			return make(TOK_EQUALS, "=", l, c);
+		case '(':
+			advance();
+			return make(TOK_LPAREN, "(", l, c);
+		case ')':
+			advance();
+			return make(TOK_RPAREN, ")", l, c);
+		case ',':
+			advance();
+			return make(TOK_COMMA, ",", l, c);
+		case '{':
+			advance();
+			atStatementStart = true;
+			// "configuration Name {" opens settings, anything else a function
+			blocks.push_back(!(firstWord == "configuration" && statementTokens == 2 && lastType == TOK_IDENT));
+			return make(TOK_LBRACE, "{", l, c);
+		case '}':
+			advance();
+			atStatementStart = true;
+			if (!blocks.empty()) blocks.pop_back();
+			return make(TOK_RBRACE, "}", l, c);
+		case '"':
+		case '\'':
+			return lexString(ch, l, c);
+	}
+
+	if (!isIdentChar(ch)) {
+		advance();
+		return make(TOK_ERROR, std::string("unexpected character '") + ch + "'", l, c);
+	}
+
+	size_t start = pos;
+	bool digits = true;
+	while (pos < src.size() && isIdentChar(src[pos])) {
+		if (src[pos] < '0' || src[pos] > '9') digits = false;
+		advance();
+	}
+	std::string word = src.substr(start, pos - start);
+
+	if (digits) return make(TOK_NUMBER, word, l, c);
+	if (statementStart && takesRestOfLine(word, !blocks.empty() && blocks.back())) {
+		wantCommand = true;
+		commandKeyword = lower(word);
+	}
+	return make(TOK_IDENT, word, l, c);
+}
+
+const char* tokenName(TokenType type) {
+	switch (type) {
+		case TOK_IDENT: return "a name";
+		case TOK_STRING: return "a string";
+		case TOK_NUMBER: return "a number";
+		case TOK_COMMAND: return "a command";
+		case TOK_EQUALS: return "'='";
+		case TOK_LPAREN: return "'('";
+		case TOK_RPAREN: return "')'";
+		case TOK_COMMA: return "','";
+		case TOK_LBRACE: return "'{'";
+		case TOK_RBRACE: return "'}'";
+		case TOK_NEWLINE: return "end of line";
+		case TOK_EOF: return "end of file";
+		case TOK_ERROR: return "an error";
+	}
+	return "a token";
+}
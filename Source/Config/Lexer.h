@@ -0,0 +1,53 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <string>
+#include <vector>
+
+enum TokenType {
+	TOK_IDENT,
+	TOK_STRING,
+	TOK_NUMBER,
+	TOK_COMMAND, // the rest of a line after "run", "inputs" or "outputs"
+	TOK_EQUALS,
+	TOK_LPAREN,
+	TOK_RPAREN,
+	TOK_COMMA,
+	TOK_LBRACE,
+	TOK_RBRACE,
+	TOK_NEWLINE,
+	TOK_EOF,
+	TOK_ERROR,
+};
+
+struct Token {
+	TokenType type;
+	std::string text; // identifier, unquoted string, number, command, or error message
+	int line, column;
+};
+
+class Lexer {
+public:
+	Lexer(const std::string& source);
+	Token next();
+
+private:
+	Token make(TokenType type, std::string text, int line, int column);
+	Token lexString(char quote, int line, int column);
+	Token lexCommand(int line, int column);
+	void advance();
+
+	const std::string& src;
+	size_t pos;
+	int line, column;
+	std::vector<bool> blocks; // open braces, true for a function body
+	bool atStatementStart, wantCommand;
+	std::string commandKeyword;
+	std::string firstWord; // of the statement so far, lowercased
+	int statementTokens;
+	TokenType lastType;
+};
+
+const char* tokenName(TokenType type);
+
+#endif /* LEXER_H */
@@ -0,0 +1,292 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Parser.cpp
+// Purpose: turns config tokens into a Config.
+//
+// The whole language, one statement per line:
+//
+//   Name = "value"          string (may span lines), number, true/false
+//   run some command        run a command before the build
+//   name() { run ... }      define a function, the parens are optional
+//   name(a, b) { ... }      a function that runs after functions a and b
+//   name()                  call a function
+//   configuration Name {    settings for one configuration of the build,
+//     CXX_FLAGS = "-O2"     on top of the ones above, picked with --config
+//   }
+//   # comment
+//
+// Inside a function body:
+//
+//   run some command        run a command
+//   inputs a.proto b.proto  the function is skipped when all its outputs
+//   outputs a.pb.cc         are newer than all its inputs
+//
+//===================================================================//
+
+#include "Parser.h"
+#include "Lexer.h"
+#include "../Utils/ProcessUtils.h"
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <map>
+
+namespace {
+
+std::string lowerWord(const std::string& word) {
+	std::string out;
+	for (char c : word) out += (c >= 'A' && c <= 'Z') ? c + 32 : c;
+	return out;
+}
+
+class Parser {
+public:
+	Parser(const std::string& source, Config& config) : lexer(source), config(config) {}
+	bool parse();
+
+	std::string error;
+
+private:
+	void next() { tok = lexer.next(); }
+	bool fail(const Token& at, const std::string& message);
+	bool expectEnd();
+	bool parseAssignment(const Token& name, std::vector<ConfigVar>& vars);
+	bool parseFunction(const Token& name, const std::vector<Token>& deps);
+	bool parseConfiguration(const Token& name);
+	bool checkDependencies();
+
+	Lexer lexer;
+	Token tok;
+	Config& config;
+	std::map<std::string, size_t> functionIndex;
+	std::vector<std::pair<size_t, Token>> depTokens; // function, dependency
+};
+
+bool Parser::fail(const Token& at, const std::string& message) {
+	if (error.empty())
+		error = config.path + ":" + std::to_string(at.line) + ":" + std::to_string(at.column) + ": error: " + message;
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// every statement has to be followed by a newline or the end of the file
+//-----------------------------------------------------------------------------
+bool Parser::expectEnd() {
+	if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+	if (tok.type != TOK_NEWLINE && tok.type != TOK_EOF)
+		return fail(tok, std::string("expected end of line, got ") + tokenName(tok.type));
+	return true;
+}
+
+bool Parser::parseAssignment(const Token& name, std::vector<ConfigVar>& vars) {
+	next();
+	ConfigVar var = {name.text, 0, name.line, name.column};
+
+	if (tok.type == TOK_STRING) {
+		var.value = tok.text;
+	} else if (tok.type == TOK_NUMBER) {
+		unsigned long long n = 0;
+		for (char c : tok.text) {
+			n = n * 10 + (c - '0');
+			if (n > INT_MAX) return fail(tok, "number '" + tok.text + "' is too large");
+		}
+		var.value = (int)n;
+	} else if (tok.type == TOK_IDENT) {
+		std::string word;
+		for (char c : tok.text) word += (c >= 'A' && c <= 'Z') ? c + 32 : c;
+		if (word == "true") var.value = true;
+		else if (word == "false") var.value = false;
+		else return fail(tok, "expected a quoted string, number, true or false, got '" + tok.text + "'");
+	} else if (tok.type == TOK_ERROR) {
+		return fail(tok, tok.text);
+	} else {
+		return fail(tok, std::string("expected a value after '=', got ") + tokenName(tok.type));
+	}
+
+	vars.push_back(var);
+	next();
+	return expectEnd();
+}
+
+bool Parser::parseFunction(const Token& name, const std::vector<Token>& deps) {
+	auto it = functionIndex.find(name.text);
+	if (it != functionIndex.end())
+		return fail(name, "function '" + name.text + "' is already defined on line " + std::to_string(config.functions[it->second].line));
+
+	ConfigFunction func;
+	func.name = name.text;
+	func.line = name.line;
+	func.column = name.column;
+	for (const auto& dep : deps) {
+		func.deps.push_back(dep.text);
+		depTokens.push_back({config.functions.size(), dep});
+	}
+	while (true) {
+		next();
+		if (tok.type == TOK_NEWLINE) continue;
+		if (tok.type == TOK_RBRACE) break;
+		if (tok.type == TOK_EOF) return fail(name, "function '" + name.text + "' is missing its closing '}'");
+		if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+		if (tok.type != TOK_IDENT) return fail(tok, std::string("expected 'run', 'inputs', 'outputs' or '}', got ") + tokenName(tok.type));
+
+		Token keyword = tok;
+		next();
+		if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+		if (tok.type != TOK_COMMAND) return fail(keyword, "only 'run', 'inputs' and 'outputs' are allowed inside a function, got '" + keyword.text + "'");
+
+		std::string word;
+		for (char c : keyword.text) word += (c >= 'A' && c <= 'Z') ? c + 32 : c;
+		if (word == "run") {
+			func.commands.push_back(tok.text);
+		} else {
+			std::vector<std::string>& paths = word == "inputs" ? func.inputs : func.outputs;
+			for (const auto& path : splitArgs(tok.text)) paths.push_back(path);
+		}
+	}
+
+	functionIndex[func.name] = config.functions.size();
+	config.functions.push_back(func);
+	next();
+	return expectEnd();
+}
+
+//-----------------------------------------------------------------------------
+// configuration Name { ... }, only settings are allowed inside
+//-----------------------------------------------------------------------------
+bool Parser::parseConfiguration(const Token& name) {
+	if (const ConfigBlock* other = config.findConfiguration(name.text))
+		return fail(name, "configuration '" + name.text + "' is already defined on line " + std::to_string(other->line));
+	if (lowerWord(name.text) == "all") return fail(name, "'all' can't be a configuration name, --config=all builds every configuration");
+
+	next();
+	if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+	if (tok.type != TOK_LBRACE) return fail(tok, std::string("expected '{' after 'configuration ") + name.text + "', got " + tokenName(tok.type));
+
+	ConfigBlock block = {name.text, {}, name.line, name.column};
+	while (true) {
+		next();
+		if (tok.type == TOK_NEWLINE) continue;
+		if (tok.type == TOK_RBRACE) break;
+		if (tok.type == TOK_EOF) return fail(name, "configuration '" + name.text + "' is missing its closing '}'");
+		if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+		if (tok.type != TOK_IDENT) return fail(tok, std::string("expected a setting or '}', got ") + tokenName(tok.type));
+
+		Token setting = tok;
+		next();
+		if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+		if (tok.type != TOK_EQUALS) return fail(setting, "only settings (Name = value) are allowed inside a configuration, got '" + setting.text + "'");
+		if (!parseAssignment(setting, block.vars)) return false;
+	}
+
+	config.configurations.push_back(block);
+	next();
+	return expectEnd();
+}
+
+bool Parser::parse() {
+	next();
+	while (tok.type != TOK_EOF) {
+		if (tok.type == TOK_NEWLINE) {
+			next();
+			continue;
+		}
+		if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+		if (tok.type != TOK_IDENT) return fail(tok, std::string("expected a statement, got ") + tokenName(tok.type));
+
+		Token name = tok;
+		next();
+
+		if (tok.type == TOK_COMMAND) {
+			config.statements.push_back({STMT_RUN, tok.text, name.line, name.column});
+			next();
+			if (!expectEnd()) return false;
+		} else if (tok.type == TOK_EQUALS) {
+			if (!parseAssignment(name, config.vars)) return false;
+		} else if (tok.type == TOK_IDENT && lowerWord(name.text) == "configuration") {
+			Token blockName = tok;
+			if (!parseConfiguration(blockName)) return false;
+		} else if (tok.type == TOK_LBRACE) {
+			if (!parseFunction(name, {})) return false;
+		} else if (tok.type == TOK_LPAREN) {
+			std::vector<Token> deps;
+			next();
+			while (tok.type == TOK_IDENT) {
+				deps.push_back(tok);
+				next();
+				if (tok.type != TOK_COMMA) break;
+				next();
+			}
+			if (tok.type == TOK_ERROR) return fail(tok, tok.text);
+			if (tok.type != TOK_RPAREN) return fail(tok, std::string("expected ')', got ") + tokenName(tok.type));
+			next();
+			if (tok.type == TOK_LBRACE) {
+				if (!parseFunction(name, deps)) return false;
+			} else if (!deps.empty()) {
+				return fail(tok, "expected '{' after the dependencies of '" + name.text + "'");
+			} else {
+				config.statements.push_back({STMT_CALL, name.text, name.line, name.column});
+				if (!expectEnd()) return false;
+			}
+		} else if (tok.type == TOK_ERROR) {
+			return fail(tok, tok.text);
+		} else {
+			return fail(tok, "expected '=', '(' or '{' after '" + name.text + "'");
+		}
+		if (tok.type != TOK_EOF) next();
+	}
+
+	// Calls may come before the definition, so check them at the end.
+	for (const auto& stmt : config.statements) {
+		if (stmt.kind == STMT_CALL && !functionIndex.count(stmt.text)) {
+			Token at = {TOK_IDENT, stmt.text, stmt.line, stmt.column};
+			return fail(at, "call to undefined function '" + stmt.text + "'");
+		}
+	}
+	return checkDependencies();
+}
+
+//-----------------------------------------------------------------------------
+// every dependency has to be a function, and they can't go round in a circle
+//-----------------------------------------------------------------------------
+bool Parser::checkDependencies() {
+	for (const auto& dep : depTokens) {
+		if (!functionIndex.count(dep.second.text))
+			return fail(dep.second, "'" + config.functions[dep.first].name + "' depends on undefined function '" + dep.second.text + "'");
+	}
+
+	enum { UNVISITED, VISITING, DONE };
+	std::vector<int> state(config.functions.size(), UNVISITED);
+	std::vector<size_t> path;
+	std::function<bool(size_t)> visit = [&](size_t f) {
+		if (state[f] == DONE) return true;
+		path.push_back(f);
+		if (state[f] == VISITING) {
+			std::string cycle;
+			for (size_t i = std::find(path.begin(), path.end(), f) - path.begin(); i < path.size(); i++)
+				cycle += (cycle.empty() ? "" : " -> ") + config.functions[path[i]].name;
+			const ConfigFunction& func = config.functions[f];
+			return fail({TOK_IDENT, func.name, func.line, func.column}, "dependency cycle: " + cycle);
+		}
+		state[f] = VISITING;
+		for (const auto& dep : config.functions[f].deps) {
+			if (!visit(functionIndex[dep])) return false;
+		}
+		state[f] = DONE;
+		path.pop_back();
+		return true;
+	};
+	for (size_t f = 0; f < config.functions.size(); f++) {
+		if (!visit(f)) return false;
+	}
+	return true;
+}
+
+} // namespace
+
+bool parseConfig(const std::string& source, Config& config, std::string& error) {
+	Parser parser(source, config);
+	bool ok = parser.parse();
+	error = parser.error;
+	return ok;
+}
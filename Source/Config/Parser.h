@@ -0,0 +1,10 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "Config.h"
+
+#include <string>
+
+bool parseConfig(const std::string& source, Config& config, std::string& error);
+
+#endif /* PARSER_H */
@@ -0,0 +1,129 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: ConfigTests.cpp
+// Purpose: parsed config cache round trips and damaged cache entries.
+//
+//===================================================================//
+
+#include "Tests.h"
+#include "../Build/Cache.h"
+#include "../Config/Config.h"
+#include "../Utils/FileUtils.h"
+
+#include <unistd.h>
+
+static const char SAMPLE[] =
+	"# every kind of statement the cache has to keep\n"
+	"Name = \"Example\"\n"
+	"Type = \"Program\"\n"
+	"CXX_FLAGS = \"-O2 -Wall \\\n  -Wextra\"\n"
+	"Empty = \"\"\n"
+	"Cache = true\n"
+	"Unity = false\n"
+	"CacheSize = 2048\n"
+	"\n"
+	"protos() {\n"
+	"  inputs Proto/api.proto Proto/types.proto\n"
+	"  outputs Source/api.pb.cc\n"
+	"  run protoc --cpp_out=Source Proto/api.proto\n"
+	"}\n"
+	"\n"
+	"generate(protos) {\n"
+	"  run ./Scripts/gen.sh\n"
+	"  run echo done\n"
+	"}\n"
+	"\n"
+	"run echo \"Building...\"\n"
+	"generate()\n"
+	"\n"
+	"configuration Debug {\n"
+	"  CXX_FLAGS = \"-O0 -g\"\n"
+	"  LTO = false\n"
+	"}\n"
+	"configuration Empty {\n"
+	"}\n";
+
+static bool sameVars(const std::vector<ConfigVar>& a, const std::vector<ConfigVar>& b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].name != b[i].name || a[i].value != b[i].value || a[i].line != b[i].line || a[i].column != b[i].column) return false;
+	}
+	return true;
+}
+
+static bool sameConfig(const Config& a, const Config& b) {
+	if (a.path != b.path || a.hash != b.hash || !sameVars(a.vars, b.vars)) return false;
+	if (a.functions.size() != b.functions.size() || a.statements.size() != b.statements.size() || a.configurations.size() != b.configurations.size()) return false;
+	for (size_t i = 0; i < a.functions.size(); i++) {
+		const ConfigFunction& x = a.functions[i];
+		const ConfigFunction& y = b.functions[i];
+		if (x.name != y.name || x.commands != y.commands || x.deps != y.deps || x.inputs != y.inputs || x.outputs != y.outputs) return false;
+		if (x.line != y.line || x.column != y.column) return false;
+	}
+	for (size_t i = 0; i < a.statements.size(); i++) {
+		const ConfigStatement& x = a.statements[i];
+		const ConfigStatement& y = b.statements[i];
+		if (x.kind != y.kind || x.text != y.text || x.line != y.line || x.column != y.column) return false;
+	}
+	for (size_t i = 0; i < a.configurations.size(); i++) {
+		const ConfigBlock& x = a.configurations[i];
+		const ConfigBlock& y = b.configurations[i];
+		if (x.name != y.name || x.line != y.line || x.column != y.column || !sameVars(x.vars, y.vars)) return false;
+	}
+	return true;
+}
+
+void configTests() {
+	std::string path = testDir() + "/config";
+	writeFile(path, SAMPLE);
+
+	// the first load parses and writes the cache entry, the second reads it
+	Config parsed, cached;
+	std::string error;
+	CHECK(loadConfig(path, parsed, error));
+	std::string entry = defaultCacheDir() + "/config/" + parsed.hash;
+	CHECK(access(entry.c_str(), R_OK) == 0);
+	CHECK(loadConfig(path, cached, error));
+	CHECK(sameConfig(parsed, cached));
+
+	// spot check that what round-tripped is what the file says
+	CHECK(cached.vars.size() == 7);
+	CHECK(cached.vars.size() > 6 && cached.vars[2].value == ConfigValue(std::string("-O2 -Wall   -Wextra")));
+	CHECK(cached.vars.size() > 6 && cached.vars[3].value == ConfigValue(std::string()));
+	CHECK(cached.vars.size() > 6 && cached.vars[4].value == ConfigValue(true));
+	CHECK(cached.vars.size() > 6 && cached.vars[6].value == ConfigValue(2048));
+	const ConfigFunction* protos = cached.findFunction("protos");
+	CHECK(protos && protos->inputs == std::vector<std::string>({"Proto/api.proto", "Proto/types.proto"}));
+	CHECK(protos && protos->outputs == std::vector<std::string>({"Source/api.pb.cc"}));
+	const ConfigFunction* generate = cached.findFunction("generate");
+	CHECK(generate && generate->deps == std::vector<std::string>({"protos"}) && generate->commands.size() == 2);
+	CHECK(cached.statements.size() == 2);
+	CHECK(cached.statements.size() == 2 && cached.statements[0].kind == STMT_RUN && cached.statements[1].kind == STMT_CALL);
+	const ConfigBlock* debug = cached.findConfiguration("Debug");
+	CHECK(debug && debug->vars.size() == 2 && debug->line == 25);
+	const ConfigBlock* empty = cached.findConfiguration("Empty");
+	CHECK(empty && empty->vars.empty());
+
+	// a damaged entry is ignored, the config is parsed again and the entry
+	// rewritten
+	std::string good = readFile(entry);
+	for (size_t cut : {(size_t)0, (size_t)4, good.size() / 2, good.size() - 1}) {
+		writeFile(entry, good.substr(0, cut));
+		Config reloaded;
+		CHECK(loadConfig(path, reloaded, error));
+		CHECK(sameConfig(parsed, reloaded));
+		CHECK(readFile(entry) == good);
+	}
+	writeFile(entry, good + "x");
+	Config trailing;
+	CHECK(loadConfig(path, trailing, error));
+	CHECK(sameConfig(parsed, trailing));
+
+	// a config that doesn't parse isn't cached
+	std::string bad = testDir() + "/bad-config";
+	writeFile(bad, "Name = \"unterminated\n");
+	Config broken;
+	CHECK(!loadConfig(bad, broken, error));
+	CHECK(error.compare(0, bad.size() + 5, bad + ":1:8:") == 0);
+	CHECK(access((defaultCacheDir() + "/config/" + broken.hash).c_str(), F_OK) != 0);
+}
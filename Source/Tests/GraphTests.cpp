@@ -0,0 +1,128 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: GraphTests.cpp
+// Purpose: build graph save/load round trips and damaged graph files.
+//
+//===================================================================//
+
+#include "Tests.h"
+#include "../Build/Graph.h"
+#include "../Utils/FileUtils.h"
+
+static BuildGraph sampleGraph() {
+	BuildGraph graph;
+	graph.key = "settings-key";
+	graph.linkHash = "link-hash";
+	graph.archiveHash = "";
+
+	uint32_t dir = graph.addNode("Source", NODE_DIR);
+	uint32_t source = graph.addNode("Source/main.cpp", NODE_SOURCE);
+	uint32_t header = graph.addNode("Include/main.h", NODE_HEADER);
+	uint32_t object = graph.addNode("Build/main.cpp.o", NODE_OBJECT);
+	uint32_t output = graph.addNode("./main", NODE_OUTPUT);
+	uint32_t unity = graph.addNode("Build/unity/batch-0.cpp", NODE_UNITY);
+	uint32_t unityObject = graph.addNode("Build/unity/batch-0.cpp.o", NODE_OBJECT);
+	graph.nodes[dir].state = {1, 4096};
+	graph.nodes[source].state = {1700000000123456789LL, 120};
+	graph.nodes[header].state = {-1, -1};
+	graph.nodes[object].state = {1700000000999999999LL, 4000};
+	graph.nodes[output].state = {1700000001000000000LL, 9000};
+
+	GraphTarget target;
+	target.object = object;
+	target.source = source;
+	target.inputs = {header};
+	target.commandHash = "cmd-hash";
+	target.command = "g++ -c $in -o $out -MMD -MF $depfile";
+	target.reason = "source changed";
+	target.objectHash = "object-hash";
+	target.durationMs = 1234;
+	target.peakRssKb = 56789;
+	graph.targets.push_back(target);
+
+	// no inputs, and strings shared with the first target
+	GraphTarget batch;
+	batch.object = unityObject;
+	batch.source = unity;
+	batch.commandHash = "cmd-hash";
+	batch.command = target.command;
+	graph.targets.push_back(batch);
+	graph.reindex();
+	return graph;
+}
+
+static bool sameGraph(const BuildGraph& a, const BuildGraph& b) {
+	if (a.key != b.key || a.linkHash != b.linkHash || a.archiveHash != b.archiveHash) return false;
+	if (a.nodes.size() != b.nodes.size() || a.targets.size() != b.targets.size()) return false;
+	for (size_t i = 0; i < a.nodes.size(); i++) {
+		if (a.nodes[i].path != b.nodes[i].path || a.nodes[i].kind != b.nodes[i].kind || a.nodes[i].state != b.nodes[i].state) return false;
+	}
+	for (size_t i = 0; i < a.targets.size(); i++) {
+		const GraphTarget& x = a.targets[i];
+		const GraphTarget& y = b.targets[i];
+		if (x.object != y.object || x.source != y.source || x.inputs != y.inputs) return false;
+		if (x.commandHash != y.commandHash || x.command != y.command || x.reason != y.reason || x.objectHash != y.objectHash) return false;
+		if (x.durationMs != y.durationMs || x.peakRssKb != y.peakRssKb) return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// loads a copy of the graph file after damage() changed its bytes, and
+// returns the load error
+//-----------------------------------------------------------------------------
+template <typename F>
+static std::string loadDamaged(const std::string& good, F damage, BuildGraph& graph) {
+	std::string data = readFile(good);
+	damage(data);
+	std::string path = testDir() + "/graph-damaged";
+	writeFile(path, data);
+	std::string error;
+	CHECK(!graph.load(path, error));
+	CHECK(graph.nodes.empty() && graph.targets.empty() && graph.key.empty());
+	CHECK(graph.findNode("Source/main.cpp") == -1);
+	return error;
+}
+
+void graphTests() {
+	std::string path = testDir() + "/graph";
+	BuildGraph graph = sampleGraph();
+	CHECK(graph.save(path));
+
+	BuildGraph loaded;
+	std::string error;
+	CHECK(loaded.load(path, error));
+	CHECK(error.empty());
+	CHECK(sameGraph(graph, loaded));
+	CHECK(loaded.findNode("Include/main.h") == 2);
+	CHECK(loaded.findNode("Include/other.h") == -1);
+	CHECK(loaded.findTarget(3) == 0);
+	CHECK(loaded.findTarget(6) == 1);
+	CHECK(loaded.findTarget(1) == -1);
+
+	// saving what was loaded gives the same file
+	std::string again = testDir() + "/graph-again";
+	CHECK(loaded.save(again));
+	CHECK(readFile(again) == readFile(path));
+
+	// an empty graph still round-trips
+	BuildGraph empty, emptyLoaded;
+	CHECK(empty.save(testDir() + "/graph-empty"));
+	CHECK(emptyLoaded.load(testDir() + "/graph-empty", error));
+	CHECK(emptyLoaded.nodes.empty() && emptyLoaded.targets.empty());
+
+	// a missing file isn't an error, just no graph
+	BuildGraph missing;
+	CHECK(!missing.load(testDir() + "/no-such-graph", error));
+	CHECK(error.empty());
+
+	// a graph that failed to load is left empty, even if it had nodes
+	BuildGraph damaged = sampleGraph();
+	CHECK(loadDamaged(path, [](std::string& d) { d.resize(10); }, damaged) == "truncated file");
+	CHECK(loadDamaged(path, [](std::string& d) { d.resize(d.size() - 1); }, damaged) == "size mismatch");
+	CHECK(loadDamaged(path, [](std::string& d) { d += '\0'; }, damaged) == "size mismatch");
+	CHECK(loadDamaged(path, [](std::string& d) { d[0] = 'X'; }, damaged) == "bad magic");
+	CHECK(loadDamaged(path, [](std::string& d) { d[8]++; }, damaged) == "unsupported version");
+	CHECK(loadDamaged(path, [](std::string& d) { d[d.size() - 2] ^= 1; }, damaged) == "checksum mismatch");
+	CHECK(loadDamaged(path, [](std::string& d) { d.clear(); }, damaged) == "truncated file");
+}
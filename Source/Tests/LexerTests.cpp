@@ -0,0 +1,110 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: LexerTests.cpp
+// Purpose: inputs/outputs as commands in function bodies and as plain
+// names everywhere else.
+//
+//===================================================================//
+
+#include "Tests.h"
+#include "../Config/Lexer.h"
+#include "../Config/Parser.h"
+
+#include <vector>
+
+static std::vector<Token> lex(const std::string& source) {
+	Lexer lexer(source);
+	std::vector<Token> tokens;
+	do tokens.push_back(lexer.next());
+	while (tokens.back().type != TOK_EOF && tokens.back().type != TOK_ERROR);
+	return tokens;
+}
+
+// the token right after the first identifier called name
+static const Token* after(const std::vector<Token>& tokens, const std::string& name) {
+	for (size_t i = 0; i + 1 < tokens.size(); i++) {
+		if (tokens[i].type == TOK_IDENT && tokens[i].text == name) return &tokens[i + 1];
+	}
+	return nullptr;
+}
+
+static bool hasCommand(const std::vector<Token>& tokens, const std::string& text) {
+	for (const auto& tok : tokens) {
+		if (tok.type == TOK_COMMAND && tok.text == text) return true;
+	}
+	return false;
+}
+
+static const ConfigVar* findVar(const std::vector<ConfigVar>& vars, const std::string& name) {
+	for (const auto& var : vars) {
+		if (var.name == name) return &var;
+	}
+	return nullptr;
+}
+
+void lexerTests() {
+	// settings named inputs and outputs in a configuration block
+	std::string block =
+		"configuration Debug {\n"
+		"  inputs = \"a.txt\"\n"
+		"  outputs = 2\n"
+		"}\n";
+	std::vector<Token> tokens = lex(block);
+	CHECK(tokens.back().type == TOK_EOF);
+	CHECK(after(tokens, "inputs") && after(tokens, "inputs")->type == TOK_EQUALS);
+	CHECK(after(tokens, "outputs") && after(tokens, "outputs")->type == TOK_EQUALS);
+	Config config;
+	std::string error;
+	CHECK(parseConfig(block, config, error));
+	const ConfigBlock* debug = config.findConfiguration("Debug");
+	CHECK(debug && findVar(debug->vars, "inputs") && findVar(debug->vars, "inputs")->value == ConfigValue(std::string("a.txt")));
+	CHECK(debug && findVar(debug->vars, "outputs") && findVar(debug->vars, "outputs")->value == ConfigValue(2));
+
+	// and at the top level
+	tokens = lex("inputs = \"x\"\nOutputs = \"y\"\n");
+	CHECK(after(tokens, "inputs") && after(tokens, "inputs")->type == TOK_EQUALS);
+	CHECK(after(tokens, "Outputs") && after(tokens, "Outputs")->type == TOK_EQUALS);
+
+	// in a function body they take the rest of the line, whatever case
+	std::string function =
+		"gen() {\n"
+		"  inputs a.proto b.proto\n"
+		"  OUTPUTS a.pb.cc\n"
+		"  run protoc a.proto\n"
+		"}\n";
+	tokens = lex(function);
+	CHECK(hasCommand(tokens, "a.proto b.proto"));
+	CHECK(hasCommand(tokens, "a.pb.cc"));
+	CHECK(hasCommand(tokens, "protoc a.proto"));
+	Config withFunction;
+	CHECK(parseConfig(function, withFunction, error));
+	const ConfigFunction* gen = withFunction.findFunction("gen");
+	CHECK(gen && gen->inputs == std::vector<std::string>({"a.proto", "b.proto"}));
+	CHECK(gen && gen->outputs == std::vector<std::string>({"a.pb.cc"}));
+
+	// a function after a configuration block is still a function body, and
+	// a block after a function is still settings
+	std::string mixed =
+		"configuration Release {\n"
+		"  inputs = \"r\"\n"
+		"}\n"
+		"gen() {\n"
+		"  inputs a.proto\n"
+		"}\n"
+		"configuration Debug {\n"
+		"  outputs = \"d\"\n"
+		"}\n";
+	Config both;
+	CHECK(parseConfig(mixed, both, error));
+	const ConfigFunction* mixedGen = both.findFunction("gen");
+	CHECK(mixedGen && mixedGen->inputs == std::vector<std::string>({"a.proto"}));
+	const ConfigBlock* release = both.findConfiguration("Release");
+	CHECK(release && findVar(release->vars, "inputs"));
+	const ConfigBlock* mixedDebug = both.findConfiguration("Debug");
+	CHECK(mixedDebug && findVar(mixedDebug->vars, "outputs"));
+
+	// run is a command everywhere it starts a statement
+	tokens = lex("run echo hi\ngen() {\n  run echo there\n}\n");
+	CHECK(hasCommand(tokens, "echo hi"));
+	CHECK(hasCommand(tokens, "echo there"));
+}
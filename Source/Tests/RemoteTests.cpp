@@ -0,0 +1,130 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: RemoteTests.cpp
+// Purpose: worker protocol messages and framing.
+//
+//===================================================================//
+
+#include "Tests.h"
+#include "../Build/Remote.h"
+
+#include <cstdint>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static bool sameRequest(const CompileRequest& a, const CompileRequest& b) {
+	return a.args == b.args && a.language == b.language && a.toolchain == b.toolchain && a.source == b.source;
+}
+
+static bool sameReply(const CompileReply& a, const CompileReply& b) {
+	return a.kind == b.kind && a.exitCode == b.exitCode && a.diagnostics == b.diagnostics && a.object == b.object;
+}
+
+static void messageTests() {
+	CompileRequest request;
+	request.args = {"g++", "-O2", "-DNAME=\"a b\"", ""};
+	request.language = "c++";
+	request.toolchain = "g++ (GCC) 13.2.0\nx86_64-linux-gnu";
+	request.source = std::string("int main() {}\n\0\xff", 16);
+
+	std::string data = encodeRequest(request);
+	CompileRequest decoded;
+	CHECK(decodeRequest(data, decoded));
+	CHECK(sameRequest(request, decoded));
+
+	CompileRequest none, noneDecoded;
+	CHECK(decodeRequest(encodeRequest(none), noneDecoded));
+	CHECK(sameRequest(none, noneDecoded));
+
+	// every cut short message, and one with a byte too many, is rejected
+	bool anyTruncatedAccepted = false;
+	for (size_t len = 0; len < data.size(); len++) {
+		CompileRequest partial;
+		if (decodeRequest(data.substr(0, len), partial)) anyTruncatedAccepted = true;
+	}
+	CHECK(!anyTruncatedAccepted);
+	CompileRequest longer;
+	CHECK(!decodeRequest(data + "x", longer));
+
+	// another protocol version is rejected
+	std::string other = data;
+	other[4 + 13] = '2';
+	CompileRequest otherDecoded;
+	CHECK(!decodeRequest(other, otherDecoded));
+
+	// an argument count far past the end doesn't read out of bounds
+	std::string huge = data;
+	uint32_t count = 0xffffffff;
+	huge.replace(4 + 14, sizeof(count), (const char*)&count, sizeof(count));
+	CompileRequest hugeDecoded;
+	CHECK(!decodeRequest(huge, hugeDecoded));
+
+	CompileReply reply;
+	reply.kind = "done";
+	reply.exitCode = 1;
+	reply.diagnostics = "a.cpp:1:1: error: expected ';'\n";
+	reply.object = std::string("\x7f" "ELF\0\0", 6);
+	std::string replyData = encodeReply(reply);
+	CompileReply replyDecoded;
+	CHECK(decodeReply(replyData, replyDecoded));
+	CHECK(sameReply(reply, replyDecoded));
+
+	CompileReply refused, refusedDecoded;
+	refused.kind = "refused";
+	refused.exitCode = -1;
+	CHECK(decodeReply(encodeReply(refused), refusedDecoded));
+	CHECK(sameReply(refused, refusedDecoded));
+
+	bool anyTruncatedReply = false;
+	for (size_t len = 0; len < replyData.size(); len++) {
+		CompileReply partial;
+		if (decodeReply(replyData.substr(0, len), partial)) anyTruncatedReply = true;
+	}
+	CHECK(!anyTruncatedReply);
+
+	// a request isn't a reply
+	CompileReply mixedUp;
+	CHECK(!decodeReply(data, mixedUp));
+}
+
+static void frameTests() {
+	int fds[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	// frames bigger than the socket buffer need a reader on the other end
+	std::string big(3 << 20, 'x');
+	for (size_t i = 0; i < big.size(); i += 4096) big[i] = (char)i;
+	bool sent = false;
+	std::thread writer([&]() {
+		sent = sendFrame(fds[0], "") && sendFrame(fds[0], std::string("a\0b", 3)) && sendFrame(fds[0], big);
+	});
+	std::string payload;
+	CHECK(readFrame(fds[1], payload) && payload.empty());
+	CHECK(readFrame(fds[1], payload) && payload == std::string("a\0b", 3));
+	CHECK(readFrame(fds[1], payload) && payload == big);
+	writer.join();
+	CHECK(sent);
+
+	// a length past the limit is refused before anything is allocated
+	uint32_t len = 0xffffffff;
+	CHECK(write(fds[0], &len, sizeof(len)) == sizeof(len));
+	CHECK(!readFrame(fds[1], payload));
+
+	// the peer going away mid-frame, or between frames, is an error
+	len = 100;
+	CHECK(write(fds[0], &len, sizeof(len)) == sizeof(len));
+	CHECK(write(fds[0], "short", 5) == 5);
+	close(fds[0]);
+	CHECK(!readFrame(fds[1], payload));
+	CHECK(!readFrame(fds[1], payload));
+
+	// and so is sending to a closed socket, without a SIGPIPE
+	CHECK(!sendFrame(fds[1], "hello"));
+	close(fds[1]);
+}
+
+void remoteTests() {
+	messageTests();
+	frameTests();
+}
@@ -0,0 +1,57 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: Tests.cpp
+// Purpose: runs the unit tests, built and run by "sh bootstrap check".
+//
+//===================================================================//
+
+#include "Tests.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+static int checks = 0, failures = 0;
+static std::string scratch;
+
+void check(bool ok, const char* expr, const char* file, int line) {
+	checks++;
+	if (ok) return;
+	failures++;
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+}
+
+const std::string& testDir() {
+	return scratch;
+}
+
+int main() {
+	char dir[] = "/tmp/nmake-tests.XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("nmake-tests: mkdtemp");
+		return 1;
+	}
+	scratch = dir;
+	// keep the config cache out of the user's real one
+	setenv("NMAKE_CACHE_DIR", (scratch + "/cache").c_str(), 1);
+
+	struct {
+		const char* name;
+		void (*run)();
+	} suites[] = {
+		{"graph", graphTests},
+		{"config", configTests},
+		{"remote", remoteTests},
+		{"lexer", lexerTests},
+	};
+	for (const auto& suite : suites) {
+		int before = failures;
+		suite.run();
+		printf("%-8s %s\n", suite.name, failures == before ? "ok" : "FAILED");
+	}
+
+	std::error_code ec;
+	std::filesystem::remove_all(scratch, ec);
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}
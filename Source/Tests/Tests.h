@@ -0,0 +1,18 @@
+#ifndef TESTS_H
+#define TESTS_H
+
+#include <string>
+
+// records a failed check, with where it was, and keeps going
+void check(bool ok, const char* expr, const char* file, int line);
+#define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+// a scratch directory for this run, removed when the tests finish
+const std::string& testDir();
+
+void graphTests();
+void configTests();
+void remoteTests();
+void lexerTests();
+
+#endif /* TESTS_H */
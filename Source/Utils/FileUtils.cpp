@@ -8,18 +8,59 @@
 #include "FileUtils.h"
 
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <regex>
+#include <sstream>
+#include <sys/stat.h>
 
 //-----------------------------------------------------------------------------
-// recursively searches thru directories
+// modification time in nanoseconds, or -1 if the file doesn't exist
 //-----------------------------------------------------------------------------
-void recursiveSearch(const std::filesystem::path& dir, std::vector<std::string>& paths) {
-    if (std::filesystem::exists(dir) && std::filesystem::is_directory(dir)) {
-        for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
-            if (std::filesystem::is_regular_file(entry.status())) {
-                paths.push_back(entry.path().string()); 
-            }
-        }
-    }
+long long modifiedTime(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return -1;
+    return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// mtime and size in one stat
+//-----------------------------------------------------------------------------
+FileState fileState(const std::string& path) {
+    FileState state;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return state;
+    state.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    state.size = st.st_size;
+    return state;
+}
+
+//-----------------------------------------------------------------------------
+// true if output is missing or older than input
+//-----------------------------------------------------------------------------
+bool isOutOfDate(const std::string& output, const std::string& input) {
+    long long out = modifiedTime(output);
+    return out < 0 || out < modifiedTime(input);
+}
+
+//-----------------------------------------------------------------------------
+// reads a whole file, returns an empty string if it can't be opened
+//-----------------------------------------------------------------------------
+std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+//-----------------------------------------------------------------------------
+// replaces a file's contents, creating parent directories as needed
+//-----------------------------------------------------------------------------
+bool writeFile(const std::string& path, const std::string& contents) {
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    std::error_code ec;
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << contents;
+    return out.good();
 }
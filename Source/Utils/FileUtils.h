@@ -5,6 +5,18 @@
 #include <vector>
 #include <string>
 
-void recursiveSearch(const std::filesystem::path& dir, std::vector<std::string>& paths);
+struct FileState {
+    long long mtime = -1; // nanoseconds, -1 if the file doesn't exist
+    long long size = -1;
+
+    bool operator==(const FileState& o) const { return mtime == o.mtime && size == o.size; }
+    bool operator!=(const FileState& o) const { return !(*this == o); }
+};
+
+long long modifiedTime(const std::string& path);
+FileState fileState(const std::string& path);
+bool isOutOfDate(const std::string& output, const std::string& input);
+std::string readFile(const std::string& path);
+bool writeFile(const std::string& path, const std::string& contents);
 
 #endif /* FILEUTILS_H */
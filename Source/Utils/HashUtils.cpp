@@ -0,0 +1,214 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: HashUtils.cpp
+// Purpose: hashing used for cache keys and change detection.
+//
+//===================================================================//
+
+#include "HashUtils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+Hasher::Hasher() : h1(0x243f6a8885a308d3ULL), h2(0x13198a2e03707344ULL), total(0), tailLen(0) {}
+
+void Hasher::mix(uint64_t word) {
+	h1 = rotl(h1 ^ (word * PRIME1), 31) * PRIME2;
+	h2 = rotl(h2 + (word * PRIME2), 27) * PRIME1 + h1;
+}
+
+void Hasher::update(const void* data, size_t len) {
+	const unsigned char* p = (const unsigned char*)data;
+	total += len;
+
+	if (tailLen) {
+		while (len && tailLen < 8) {
+			tail[tailLen++] = *p++;
+			len--;
+		}
+		if (tailLen < 8) return;
+		uint64_t word;
+		memcpy(&word, tail, 8);
+		mix(word);
+		tailLen = 0;
+	}
+
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		mix(word);
+		p += 8;
+		len -= 8;
+	}
+
+	memcpy(tail, p, len);
+	tailLen = len;
+}
+
+void Hasher::update(const std::string& str) {
+	// length first so ("ab", "c") and ("a", "bc") don't collide
+	uint64_t len = str.size();
+	update(&len, sizeof(len));
+	update(str.data(), str.size());
+}
+
+//-----------------------------------------------------------------------------
+// finishes the hash, the hasher shouldn't be used after
+//-----------------------------------------------------------------------------
+void Hasher::finish(uint64_t& a, uint64_t& b) {
+	uint64_t word = 0;
+	memcpy(&word, tail, tailLen);
+	mix(word ^ ((uint64_t)tailLen << 56));
+
+	a = fmix(h1 ^ total);
+	b = fmix(h2 + a);
+	a += b;
+}
+
+//-----------------------------------------------------------------------------
+// finishes the hash as 32 hex digits
+//-----------------------------------------------------------------------------
+std::string Hasher::hex() {
+	uint64_t a, b;
+	finish(a, b);
+
+	static const char digits[] = "0123456789abcdef";
+	std::string out(32, '0');
+	for (int i = 0; i < 16; i++) {
+		out[15 - i] = digits[(a >> (i * 4)) & 0xf];
+		out[31 - i] = digits[(b >> (i * 4)) & 0xf];
+	}
+	return out;
+}
+
+static const uint32_t SHA256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, int r) {
+	return (x >> r) | (x << (32 - r));
+}
+
+Sha256::Sha256() : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}, total(0), bufferLen(0) {}
+
+void Sha256::block(const unsigned char* data) {
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++) w[i] = (uint32_t)data[i*4] << 24 | (uint32_t)data[i*4+1] << 16 | (uint32_t)data[i*4+2] << 8 | data[i*4+3];
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+		uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void Sha256::update(const void* data, size_t len) {
+	const unsigned char* p = (const unsigned char*)data;
+	total += len;
+	if (bufferLen) {
+		size_t take = std::min(len, sizeof(buffer) - bufferLen);
+		memcpy(buffer + bufferLen, p, take);
+		bufferLen += take;
+		p += take;
+		len -= take;
+		if (bufferLen < sizeof(buffer)) return;
+		block(buffer);
+		bufferLen = 0;
+	}
+	for (; len >= 64; p += 64, len -= 64) block(p);
+	memcpy(buffer, p, len);
+	bufferLen = len;
+}
+
+void Sha256::update(const std::string& str) {
+	uint64_t len = str.size();
+	update(&len, sizeof(len));
+	update(str.data(), str.size());
+}
+
+//-----------------------------------------------------------------------------
+// finishes the hash as 64 hex digits, the hasher shouldn't be used after
+//-----------------------------------------------------------------------------
+std::string Sha256::hex() {
+	uint64_t bits = total * 8;
+	unsigned char pad[72] = {0x80};
+	size_t padLen = (bufferLen < 56 ? 56 : 120) - bufferLen;
+	for (int i = 0; i < 8; i++) pad[padLen + i] = bits >> (56 - i * 8);
+	update(pad, padLen + 8);
+
+	static const char digits[] = "0123456789abcdef";
+	std::string out;
+	for (uint32_t word : state) {
+		for (int shift = 28; shift >= 0; shift -= 4) out += digits[(word >> shift) & 0xf];
+	}
+	return out;
+}
+
+std::string hashString(const std::string& str) {
+	Hasher h;
+	h.update(str);
+	return h.hex();
+}
+
+//-----------------------------------------------------------------------------
+// feeds a whole file into the hasher, returns false if it can't be read
+//-----------------------------------------------------------------------------
+template <typename H>
+static bool hashFileWith(const std::string& path, H& hasher) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+
+	char buf[65536];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) hasher.update(buf, n);
+	close(fd);
+	return n == 0;
+}
+
+bool hashFile(const std::string& path, Hasher& hasher) {
+	return hashFileWith(path, hasher);
+}
+
+bool hashFile(const std::string& path, Sha256& hasher) {
+	return hashFileWith(path, hasher);
+}
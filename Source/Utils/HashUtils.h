@@ -0,0 +1,47 @@
+#ifndef HASHUTILS_H
+#define HASHUTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 128-bit non-cryptographic hash, fed incrementally
+class Hasher {
+public:
+	Hasher();
+	void update(const void* data, size_t len);
+	void update(const std::string& str);
+	void finish(uint64_t& a, uint64_t& b);
+	std::string hex();
+
+private:
+	void mix(uint64_t word);
+
+	uint64_t h1, h2, total;
+	unsigned char tail[8];
+	size_t tailLen;
+};
+
+// SHA-256, for keys whose hits are trusted without checking what they point
+// to, fed the same way as Hasher
+class Sha256 {
+public:
+	Sha256();
+	void update(const void* data, size_t len);
+	void update(const std::string& str);
+	std::string hex();
+
+private:
+	void block(const unsigned char* data);
+
+	uint32_t state[8];
+	uint64_t total;
+	unsigned char buffer[64];
+	size_t bufferLen;
+};
+
+std::string hashString(const std::string& str);
+bool hashFile(const std::string& path, Hasher& hasher);
+bool hashFile(const std::string& path, Sha256& hasher);
+
+#endif /* HASHUTILS_H */
@@ -0,0 +1,231 @@
+//========= Copyright N11 Software, All rights reserved. ============//
+//
+// File: ProcessUtils.cpp
+// Purpose: launching child processes without going through /bin/sh.
+//
+//===================================================================//
+
+#include "ProcessUtils.h"
+#include "StringUtils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+//-----------------------------------------------------------------------------
+// splits a string into words the way sh would, minus any expansion:
+// whitespace separates, quotes group, and backslash escapes
+//-----------------------------------------------------------------------------
+std::vector<std::string> splitArgs(const std::string& str) {
+	std::vector<std::string> args;
+	std::string word;
+	bool inWord = false;
+	char quote = 0;
+
+	for (size_t i = 0; i < str.size(); i++) {
+		char c = str[i];
+		if (quote == '\'') {
+			if (c == '\'') quote = 0;
+			else word += c;
+		} else if (quote == '"') {
+			if (c == '"') quote = 0;
+			else if (c == '\\' && i + 1 < str.size() && strchr("\"\\$`", str[i+1])) word += str[++i];
+			else word += c;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			inWord = true;
+		} else if (c == '\\' && i + 1 < str.size()) {
+			word += str[++i];
+			inWord = true;
+		} else if (c == ' ' || c == '\t' || c == '\n') {
+			if (inWord) args.push_back(word);
+			word.clear();
+			inWord = false;
+		} else {
+			word += c;
+			inWord = true;
+		}
+	}
+	if (inWord) args.push_back(word);
+
+	return args;
+}
+
+//-----------------------------------------------------------------------------
+// quotes an argument so sh would read it back as the same single word
+//-----------------------------------------------------------------------------
+std::string quoteArg(const std::string& arg) {
+	if (!arg.empty() && arg.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+=/.,:@%") == std::string::npos)
+		return arg;
+
+	std::string out = "'";
+	for (char c : arg) {
+		if (c == '\'') out += "'\\''";
+		else out += c;
+	}
+	return out + "'";
+}
+
+std::string joinArgs(const std::vector<std::string>& args) {
+	std::string out;
+	for (const auto& arg : args) {
+		if (!out.empty()) out += ' ';
+		out += quoteArg(arg);
+	}
+	return out;
+}
+
+//-----------------------------------------------------------------------------
+// true if a command uses anything splitArgs can't handle (pipes,
+// redirects, expansions, globs...) and has to be run by a real shell
+//-----------------------------------------------------------------------------
+bool needsShell(const std::string& command) {
+	return command.find_first_of("|&;<>()$`*?[~{}\n") != std::string::npos;
+}
+
+//-----------------------------------------------------------------------------
+// argv for a command string, wrapped in /bin/sh -c only when needed
+//-----------------------------------------------------------------------------
+std::vector<std::string> commandArgs(const std::string& command) {
+	if (needsShell(command)) return {"/bin/sh", "-c", command};
+	return splitArgs(command);
+}
+
+// a job's output past this is dropped, so one runaway can't eat the memory
+static const size_t CAPTURE_LIMIT = 1 << 20;
+
+static thread_local OutputCapture* currentCapture = nullptr;
+static thread_local unsigned long long peakRss = 0;
+
+void OutputCapture::append(const char* data, size_t len) {
+	size_t kept = text.size() < CAPTURE_LIMIT ? std::min(CAPTURE_LIMIT - text.size(), len) : 0;
+	text.append(data, kept);
+	dropped += len - kept;
+}
+
+//-----------------------------------------------------------------------------
+// while set, processes this thread runs write into capture instead of the
+// terminal, and so does printOutput
+//-----------------------------------------------------------------------------
+void setOutputCapture(OutputCapture* capture) {
+	currentCapture = capture;
+}
+
+void printOutput(const std::string& text) {
+	if (currentCapture) currentCapture->append(text.data(), text.size());
+	else std::cout << text << std::flush;
+}
+
+//-----------------------------------------------------------------------------
+// spawns args[0] (searched for in PATH) and waits for it. returns the raw
+// wait status like system() does, or -1 if it couldn't be started. quiet
+// sends the child's stdout and stderr to /dev/null, otherwise they go to the
+// thread's output capture when it has one.
+//-----------------------------------------------------------------------------
+int runProcess(const std::vector<std::string>& args, bool quiet) {
+	if (args.empty()) return -1;
+
+	std::vector<char*> argv;
+	for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	int pipeFds[2];
+	bool capture = !quiet && currentCapture && pipe2(pipeFds, O_CLOEXEC) == 0;
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (quiet) {
+		posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+		posix_spawn_file_actions_adddup2(&actions, 1, 2);
+	} else if (capture) {
+		posix_spawn_file_actions_adddup2(&actions, pipeFds[1], 1);
+		posix_spawn_file_actions_adddup2(&actions, pipeFds[1], 2);
+	}
+
+	pid_t pid;
+	int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (capture) close(pipeFds[1]);
+	if (err != 0) {
+		if (capture) close(pipeFds[0]);
+		if (currentCapture) printOutput(std::string("nmake: ") + argv[0] + ": " + strerror(err) + "\n");
+		else fprintf(stderr, "nmake: %s: %s\n", argv[0], strerror(err));
+		return 127 << 8;
+	}
+
+	// read to EOF before waiting, a child filling the pipe would never exit
+	if (capture) {
+		char buf[16384];
+		ssize_t n;
+		while ((n = read(pipeFds[0], buf, sizeof(buf))) != 0) {
+			if (n > 0) currentCapture->append(buf, n);
+			else if (errno != EINTR) break;
+		}
+		close(pipeFds[0]);
+	}
+
+	int status;
+	struct rusage usage;
+	while (wait4(pid, &status, 0, &usage) < 0) {
+		if (errno != EINTR) return -1;
+	}
+	// ru_maxrss is in KB, and covers the children it waited on (cc1plus
+	// under the gcc driver)
+	peakRss = std::max(peakRss, (unsigned long long)usage.ru_maxrss << 10);
+	return status;
+}
+
+//-----------------------------------------------------------------------------
+// the most memory (in bytes) any process this thread ran since the last
+// call used at once
+//-----------------------------------------------------------------------------
+unsigned long long takePeakRss() {
+	unsigned long long peak = peakRss;
+	peakRss = 0;
+	return peak;
+}
+
+//-----------------------------------------------------------------------------
+// wait status to a shell style exit code (128 + signal if it was killed)
+//-----------------------------------------------------------------------------
+int exitCode(int status) {
+	if (status == -1) return -1;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+//-----------------------------------------------------------------------------
+// every file named program in PATH, in PATH order
+//-----------------------------------------------------------------------------
+std::vector<std::string> findExecutables(const std::string& program) {
+	std::vector<std::string> paths;
+	const char* pathEnv = std::getenv("PATH");
+	if (!pathEnv) {
+		std::cerr << "PATH environment variable not found." << std::endl;
+		return paths;
+	}
+
+	std::vector<std::string> directories = split(pathEnv, ':');
+
+	for (const auto& dir : directories) {
+		std::filesystem::path p = dir + '/' + program;
+		if (std::filesystem::exists(p) && std::filesystem::is_regular_file(p))
+			paths.push_back(p.string());
+	}
+	return paths;
+}
+
+std::string getEnvVar(const std::string& key) {
+	char* val = getenv(key.c_str());
+	return val == (void*)0 ? std::string("") : std::string(val);
+}
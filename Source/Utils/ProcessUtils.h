@@ -0,0 +1,29 @@
+#ifndef PROCESSUTILS_H
+#define PROCESSUTILS_H
+
+#include <string>
+#include <vector>
+
+std::vector<std::string> splitArgs(const std::string& str);
+std::string quoteArg(const std::string& arg);
+std::string joinArgs(const std::vector<std::string>& args);
+bool needsShell(const std::string& command);
+std::vector<std::string> commandArgs(const std::string& command);
+
+// what the processes a thread runs print, kept to be shown all at once
+struct OutputCapture {
+	std::string text;
+	size_t dropped = 0; // bytes past the limit that were thrown away
+	void append(const char* data, size_t len);
+};
+
+void setOutputCapture(OutputCapture* capture);
+void printOutput(const std::string& text);
+
+int runProcess(const std::vector<std::string>& args, bool quiet = false);
+unsigned long long takePeakRss();
+int exitCode(int status);
+std::vector<std::string> findExecutables(const std::string& program);
+std::string getEnvVar(const std::string& key);
+
+#endif /* PROCESSUTILS_H */
@@ -15,6 +15,7 @@ std::string ltrim(const std::string& str) {
 	auto start = std::find_if(str.begin(), str.end(), [](unsigned char ch) {
 		return !std::isspace(ch);
 	});
+	return std::string(start, str.end());
 }
 
 std::string rtrim(const std::string& str) {
@@ -13,6 +13,20 @@
 #include "Utils/FileUtils.h"
 #include "Utils/StringUtils.h"
 #include "Utils/TerminalUtils.h"
+#include "Utils/ProcessUtils.h"
+#include "Utils/HashUtils.h"
+#include "Build/Scheduler.h"
+#include "Build/Cache.h"
+#include "Build/Builder.h"
+#include "Build/Explain.h"
+#include "Build/Pgo.h"
+#include "Build/Remote.h"
+#include "Build/Server.h"
+#include "Build/Steps.h"
+#include "Build/Trace.h"
+#include "Build/Watch.h"
+#include "Config/Config.h"
+#include "Bench/Bench.h"
 
 #include <iostream>
 #include <fstream>
@@ -31,10 +45,27 @@
 #include <getopt.h>
 
 void usage(void) {
-	printf("nmake [-hv] <command>\n\n");
+	printf("nmake [-hvkB] [-j jobs] [-l load] [--config=name[,name...]|all] [--trace=file] [--explain-schedule] <command>\n\n");
+	printf("OPTIONS:\n");
+	printf("	-B - Rebuild everything, even objects that are up to date.\n");
+	printf("	-j jobs - Run up to this many compile jobs at once (default: number of CPUs).\n");
+	printf("	-k - Keep going after a compile job fails.\n");
+	printf("	-l load - Don't start more jobs while the load average is this high (default: twice the number of CPUs, 0 for no limit).\n");
+	printf("	--config=name - Build these configurations from the config, or all of them (default: the first one).\n");
+	printf("	--trace=file - Write a Chrome trace (open it in ui.perfetto.dev) of the build to file.\n");
+	printf("	--explain-schedule - After running jobs, compare how long they took to the best possible order.\n\n");
 	printf("AVAILABLE COMMANDS:\n");
 	printf("	new - Create a new source environment.\n");
 	printf("	add - Auto-generate a NMake config file based on an existing project.\n");
+	printf("	watch - Build, then rebuild whenever a source, header or the config changes.\n");
+	printf("	explain <file> - Say why an object (or the object built from a source) was last compiled.\n");
+	printf("	pgo - Build instrumented, run the train() function, then build optimized with the profile.\n");
+	printf("	server [start|stop] - Keep the project loaded, so builds in this directory start instantly.\n");
+	printf("	worker --listen <unix:/path | [host:]port> [--compiler name]... - Compile for other nmakes, -j at a time.\n");
+	printf("	cache --stats - Show compile cache hit/miss counts.\n");
+	printf("	cache --clear - Delete everything in the compile cache.\n");
+	printf("	bench spawn [count] - Time system() against posix_spawn on trivial jobs.\n");
+	printf("	bench project [options] - Time builds of a generated project, see Documentation/Usage.md.\n");
 }
 
 void version(void) {
@@ -45,29 +76,6 @@ void version(void) {
 	printf("See COPYRIGHT in the source tree for more information.\n");
 }
 
-std::vector<std::string> findExecutables(const std::string& program) {
-  std::vector<std::string> paths;
-  const char* pathEnv = std::getenv("PATH");
-  if (!pathEnv) {
-    std::cerr << "PATH environment variable not found." << std::endl;
-    return paths;
-  }
-
-  std::vector<std::string> directories = split(pathEnv, ':');
-
-  for (const auto& dir : directories) {
-    std::filesystem::path p = dir + '/' + program;
-    if (std::filesystem::exists(p) && std::filesystem::is_regular_file(p))
-      paths.push_back(p.string());
-  }
-  return paths;
-}
-
-std::string getEnvVar(std::string key) {
-  char* val = getenv( key.c_str() );
-  return val == (void*)0 ? std::string("") : std::string(val);
-}
-
 std::string to_lower(const std::string& str) {
   std::string newstr = str;
   std::transform(newstr.begin(), newstr.end(), newstr.begin(),
@@ -79,10 +87,20 @@ int main(int argc, char *argv[]) {
   bool newEnv = false, addingToProject = false, isCustom = false;
   std::vector<std::string> customCommand;
   std::string envName = "";
-  unsigned char type = 0, lang;
+  std::string configNames;
+  BuildOptions options;
+  options.jobs = defaultJobCount();
+  options.maxLoad = defaultJobCount() * 2;
+
+	static const struct option longOptions[] = {
+		{"trace", required_argument, nullptr, 'T'},
+		{"explain-schedule", no_argument, nullptr, 'S'},
+		{"config", required_argument, nullptr, 'C'},
+		{nullptr, 0, nullptr, 0},
+	};
 
 	int opt;
-	while ((opt = getopt(argc, argv, "hv")) != -1) {
+	while ((opt = getopt_long(argc, argv, "+hvj:l:kB", longOptions, nullptr)) != -1) {
 		switch (opt) {
 			case 'h':
 				usage();
@@ -90,6 +108,37 @@ int main(int argc, char *argv[]) {
 			case 'v':
 				version();
 				return 0;
+			case 'j':
+				if (!isDigits(optarg) || atoi(optarg) < 1) {
+					std::cerr << "Invalid job count: " << optarg << std::endl;
+					return 1;
+				}
+				options.jobs = atoi(optarg);
+				break;
+			case 'l': {
+				char* end;
+				options.maxLoad = strtod(optarg, &end);
+				if (*optarg == '\0' || *end != '\0' || options.maxLoad < 0) {
+					std::cerr << "Invalid load average: " << optarg << std::endl;
+					return 1;
+				}
+				break;
+			}
+			case 'k':
+				options.keepGoing = true;
+				break;
+			case 'B':
+				options.alwaysMake = true;
+				break;
+			case 'T':
+				traceStart(optarg);
+				break;
+			case 'S':
+				options.explainSchedule = true;
+				break;
+			case 'C':
+				configNames = optarg;
+				break;
 			default:
 				usage();
 				return 1;
@@ -101,17 +150,17 @@ int main(int argc, char *argv[]) {
 	char **remainingArgv = argv + optind;
 
   // Read arguments
-  for (int x = 1; x < argc; x++) {
+  for (int x = 0; x < remainingArgc; x++) {
     switch (x) {
-      case 1:
-        if (!strcmp(remainingArgv[0], "new")) newEnv = true;
-        else if (!strcmp(remainingArgv[0], "add")) addingToProject = true;
+      case 0:
+        if (!strcmp(remainingArgv[x], "new")) newEnv = true;
+        else if (!strcmp(remainingArgv[x], "add")) addingToProject = true;
         else {
           isCustom = true;
           customCommand.push_back(remainingArgv[x]);
         }
         break;
-      case 2:
+      case 1:
         if (newEnv || addingToProject) {
           if (std::regex_match(remainingArgv[x], std::regex("[A-Za-z0-9]+"))) {
             envName = remainingArgv[x];
@@ -119,8 +168,9 @@ int main(int argc, char *argv[]) {
             std::cerr << "Invalid environment name: " << remainingArgv[x] << std::endl;
             return 1;
           }
+          break;
         }
-        break;
+        // fall through
       default:
         // Handle custom command arguments
         customCommand.push_back(remainingArgv[x]);
@@ -196,237 +246,201 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  if (isCustom && customCommand[0] == "worker")
+    return runWorker(std::vector<std::string>(customCommand.begin() + 1, customCommand.end()), options.jobs);
+
+  if (isCustom && customCommand[0] == "bench") {
+    std::vector<std::string> args(customCommand.begin() + 1, customCommand.end());
+    if (!args.empty() && args[0] == "spawn")
+      return benchSpawn(std::vector<std::string>(args.begin() + 1, args.end()));
+    if (!args.empty() && args[0] == "project")
+      return benchProject(std::vector<std::string>(args.begin() + 1, args.end()));
+    std::cerr << "Unknown benchmark. Available: spawn, project" << std::endl;
+    return 1;
+  }
+
+  // A server running for this directory already has everything loaded.
+  if (!isCustom && !traceEnabled() && configNames.empty()) {
+    int status;
+    if (buildOnServer(options, status)) return status;
+  }
+
   // Continue to parse config
   std::string configPath = "config";
-  std::ifstream config = std::ifstream(configPath.c_str(), std::ios::binary);
-
-  if (!config.is_open()) {
-    std::cerr << "Failed to find a config file at: " << configPath << std::endl;
+  Config config;
+  std::string error;
+  TracePhase configPhase("load config");
+
+  // The cache commands work outside of a project too.
+  bool cacheCommand = isCustom && customCommand[0] == "cache";
+  if (!loadConfig(configPath, config, error) && !(cacheCommand && config.hash.empty())) {
+    std::cerr << error << std::endl;
     return 1;
   }
 
-  std::string c_comp = "", cpp_comp = "", asm_comp = "", ld = "g++";
-
-  std::vector<std::pair<std::string, std::variant<int, bool, std::string>>> vars;
-
-  std::string toks = "";
-  int lenOfConfig = std::filesystem::file_size(configPath);
-  bool inVar = false;
-  bool inQuotes = false;
-  bool inCommand = false;
-  bool maybeACall = false;
-  std::string callName = "";
-  std::string func = "";
-  std::map<std::string, std::vector<std::string>> funcs;
-  char quoteType = 0;
-  for (int c = 0; c < lenOfConfig+1; c++) {
-    char ch = c==lenOfConfig?'\n':config.get();
-    switch (ch) {
-      case '=':
-        inVar = true;
-        toks+=ch;
-        break;
-      case '\n':
-        if (inVar) {
-          // split by =
-          std::vector<std::string> parts;
-          parts.push_back(trim(toks.substr(0, toks.find_first_of('='))));
-          parts.push_back(trim(toks.substr(toks.find_first_of('=')+1)));
-          if (parts.size()!= 2) {
-            std::cerr << "Invalid config format: " << toks << std::endl;
-            return 1;
-          }
+  configPhase.end();
 
-          if (parts[1][0] == '"' || parts[1][0] == '\'') {
-            quoteType = parts[1][0];
-            inQuotes = true;
-          } else {
-            if (isDigits(parts[1])) {
-              vars.push_back({parts[0], stoi(parts[1])});
-            } else {
-              std::transform(parts[1].begin(), parts[1].end(), parts[1].begin(),
-                [](unsigned char c){ return std::tolower(c); });
-              if (parts[1] == "true") vars.push_back({parts[0], true});
-              else if (parts[1] == "false") vars.push_back({parts[0], false});
-            }
-          }
-          while (inQuotes) {
-            if (parts[1][parts[1].size()-1] == quoteType) {
-              inQuotes = false;
-              parts[1] = parts[1].substr(1, parts[1].size()-2);
-              vars.push_back({parts[0], parts[1]});
-            } // TODO: Add \ for multi line
-          }
-          if (!std::regex_match(parts[0], std::regex("[A-Za-z0-9]+"))) {
-            std::cerr << "Invalid variable name: " << parts[0] << std::endl;
-            return 1;
-          }
-          inVar = false;
-        } else if (inCommand) {
-          std::string command = trim(toks);
-          if (func == "") {
-            system(command.c_str());
-          } else {
-            funcs[func].push_back(command);
-          }
-        } else if (maybeACall) {
-          std::vector<std::string> commands = funcs[callName];
-          for (auto &cmd : commands) {
-            std::cout << cmd << std::endl;
-            system(cmd.c_str());
-          }
-          maybeACall = false;
-          callName = "";
-        }
-        toks = "";
-        break;
-      case '{': {
-        std::string funName = callName.substr(0, toks.find('('));
-        if (!std::regex_match(funName, std::regex("[A-Za-z0-9]+"))) {
-          std::cerr << "Invalid function name: " << funName << std::endl;
-          return 1;
-        }
-        callName = "";
-        func = funName;
-        funcs[funName] = std::vector<std::string>();
-        maybeACall = false;
-        toks = "";
-        break;
+  Project project;
+  project.cacheDir = defaultCacheDir();
+  project.configHash = config.hash;
+
+  // Values are typed by how they were written, complain about the wrong kind.
+  auto typeError = [&](const ConfigVar& var, const char* expected) {
+    std::cerr << configPath << ":" << var.line << ":" << var.column << ": error: " << var.name << " must be " << expected << std::endl;
+    return 1;
+  };
+
+  // Settings at the top level and inside configuration blocks.
+  auto applyVars = [&](const std::vector<ConfigVar>& vars, Project& project) {
+    for (auto &var : vars) {
+      const std::string* str = std::get_if<std::string>(&var.value);
+      const bool* flag = std::get_if<bool>(&var.value);
+      const int* num = std::get_if<int>(&var.value);
+
+      std::string* target = nullptr;
+      if (var.name == "Name") target = &project.name;
+      else if (var.name == "CC") target = &project.cc;
+      else if (var.name == "CXX") target = &project.cxx;
+      else if (var.name == "AS") target = &project.as;
+      else if (var.name == "Source") target = &project.sourceDir;
+      else if (var.name == "Build") target = &project.buildDir;
+      else if (var.name == "Output") target = &project.output;
+      else if (var.name == "CC_FLAGS") target = &project.cFlags;
+      else if (var.name == "CXX_FLAGS") target = &project.cxxFlags;
+      else if (var.name == "AS_FLAGS") target = &project.asFlags;
+      else if (var.name == "LD_FLAGS") target = &project.ldFlags;
+      else if (var.name == "LD") target = &project.ld;
+      else if (var.name == "AR") target = &project.ar;
+      else if (var.name == "Exclude") target = &project.exclude;
+      else if (var.name == "CacheDir") target = &project.cacheDir;
+      else if (var.name == "PCH") target = &project.pch;
+      else if (var.name == "Workers") target = &project.workers;
+      else if (var.name == "PGOTrain") target = &project.pgoTrain;
+
+      if (target) {
+        if (!str) return typeError(var, "a quoted string");
+        *target = *str;
+      } else if (var.name == "Type") {
+        if (!str) return typeError(var, "a quoted string");
+        project.type = to_lower(*str) == "program" ? TYPE_PROGRAM : TYPE_LIBRARY;
+      } else if (var.name == "Library") {
+        std::string kind = str ? to_lower(*str) : "";
+        if (kind == "static") project.library = LIBRARY_STATIC;
+        else if (kind == "shared") project.library = LIBRARY_SHARED;
+        else if (kind == "both") project.library = LIBRARY_STATIC | LIBRARY_SHARED;
+        else return typeError(var, "\"static\", \"shared\" or \"both\"");
+      } else if (var.name == "Cache") {
+        if (!flag) return typeError(var, "true or false");
+        project.useCache = *flag;
+      } else if (var.name == "CacheSize") {
+        if (!num) return typeError(var, "a number (in MB)");
+        project.cacheSize = (unsigned long long)*num << 20;
+      } else if (var.name == "Unity") {
+        if (!flag) return typeError(var, "true or false");
+        project.unity = *flag;
+      } else if (var.name == "LTO") {
+        if (!flag) return typeError(var, "true or false");
+        project.lto = *flag;
+      } else if (var.name == "UnityBatch") {
+        if (!num || *num < 1) return typeError(var, "a number (of files, at least 1)");
+        project.unityBatch = *num;
       }
-      case '}':
-        func = "";
-        toks = "";
-        break;
-      case '(':
-        maybeACall = true;
-        callName = toks.substr(0, toks.find('('));
-        toks = "";
-        break;
-      case ')':
-        break;
-      default:
-        toks+=ch;
-        break;
     }
-    if (trim(to_lower(toks)) == "run") {
-      inCommand = true;
-      toks = "";
+    return 0;
+  };
+  if (applyVars(config.vars, project)) return 1;
+
+  if (cacheCommand) {
+    std::string arg = customCommand.size() > 1 ? customCommand[1] : "--stats";
+    if (arg == "--stats") {
+      printCacheStats(project.cacheDir, project.cacheSize);
+    } else if (arg == "--clear") {
+      if (!clearCache(project.cacheDir)) {
+        std::cerr << "Failed to clear the cache at: " << project.cacheDir << std::endl;
+        return 1;
+      }
+    } else {
+      std::cerr << "Unknown cache option: " << arg << std::endl;
+      return 1;
     }
+    return 0;
   }
 
-  std::string SourceDir = "Source/", BuildDir = "Build/", OutPath;
-  std::string CF, CXXF, ASF, LDF;
-
-  for (auto &var : vars) {
-    if (var.first == "Name") envName = std::get<std::string>(var.second);
-    else if (var.first == "Type") type = std::get<std::string>(var.second) == "Program"? 1 : 2;
-    else if (var.first == "CC") c_comp = std::get<std::string>(var.second);
-    else if (var.first == "CXX") cpp_comp = std::get<std::string>(var.second);
-    else if (var.first == "AS") asm_comp = std::get<std::string>(var.second);
-    else if (var.first == "Source") SourceDir = std::get<std::string>(var.second);
-    else if (var.first == "Build") BuildDir = std::get<std::string>(var.second);
-    else if (var.first == "Output") OutPath = std::get<std::string>(var.second);
-    else if (var.first == "CC_FLAGS") CF = std::get<std::string>(var.second);
-    else if (var.first == "CXX_FLAGS") CXXF = std::get<std::string>(var.second);
-    else if (var.first == "AS_FLAGS") ASF = std::get<std::string>(var.second);
-    else if (var.first == "LD_FLAGS") LDF = std::get<std::string>(var.second);
-    else if (var.first == "LD") ld = std::get<std::string>(var.second);
+  // Pick the configurations to build, the first one when none is given.
+  // Each builds in a directory of its own under the top level build dir.
+  std::vector<Project> projects;
+  std::vector<std::string> names;
+  if (configNames == "all") {
+    for (const auto& block : config.configurations) names.push_back(block.name);
+  } else if (!configNames.empty()) {
+    std::string list = configNames;
+    std::replace(list.begin(), list.end(), ',', ' ');
+    names = splitArgs(list);
+  } else if (!config.configurations.empty()) {
+    names.push_back(config.configurations[0].name);
   }
-
-  if (OutPath.empty()) OutPath = "./" + envName;
-
-  if (c_comp == "") {
-    if (!getEnvVar("CC").empty()) {
-      c_comp = getEnvVar("CC");
-    } else {
-      std::vector<std::string> paths = findExecutables("gcc");
-      if (paths.empty()) {
-        paths = findExecutables("clang");
-        if (paths.empty()) {
-          std::cerr << "No C compiler found. Please declare CC." << std::endl;
-          return 1;
-        }
-        c_comp = paths[0];
-      } else {
-        c_comp = paths[0];
+  if (names.empty()) projects.push_back(project);
+
+  for (const auto& name : names) {
+    const ConfigBlock* block = config.findConfiguration(name);
+    if (!block) {
+      std::cerr << "Unknown configuration: " << name << ".";
+      if (config.configurations.empty()) std::cerr << " " << configPath << " doesn't define any.";
+      else {
+        std::cerr << " Available:";
+        for (const auto& other : config.configurations) std::cerr << " " << other.name;
       }
+      std::cerr << std::endl;
+      return 1;
     }
-  }
-
-  if (cpp_comp == "") {
-    if (!getEnvVar("CXX").empty()) {
-      cpp_comp = getEnvVar("CXX");
-    } else {
-      std::vector<std::string> paths = findExecutables("g++");
-      if (paths.empty()) {
-        paths = findExecutables("clang++");
-        if (paths.empty()) {
-          std::cerr << "No C compiler found. Please declare CXX." << std::endl;
-          return 1;
-        }
-        cpp_comp = paths[0];
-      } else {
-        cpp_comp = paths[0];
+    if (std::any_of(projects.begin(), projects.end(), [&](const Project& p) { return p.configuration == name; })) continue;
+
+    Project variant = project;
+    variant.configuration = name;
+    variant.buildDir = project.buildDir + (!project.buildDir.empty() && project.buildDir.back() == '/' ? "" : "/") + name;
+    variant.output.clear();
+    if (applyVars(block->vars, variant)) return 1;
+    if (variant.output.empty()) {
+      std::string file = project.output.empty() ? variant.name : std::filesystem::path(project.output).filename().string();
+      variant.output = variant.buildDir + "/" + file;
+    }
+    for (const auto& other : projects) {
+      if (std::filesystem::path(other.buildDir).lexically_normal() == std::filesystem::path(variant.buildDir).lexically_normal()) {
+        std::cerr << configPath << ":" << block->line << ":" << block->column << ": error: configurations '" << other.configuration << "' and '" << name << "' both build in " << variant.buildDir << std::endl;
+        return 1;
       }
     }
+    projects.push_back(variant);
   }
 
-  if (asm_comp == "") {
-    if (!getEnvVar("AS").empty()) {
-      asm_comp = getEnvVar("AS");
-    } else {
-      std::vector<std::string> paths = findExecutables("nasm");
-      if (paths.empty()) {
-        paths = findExecutables("as");
-        if (paths.empty()) {
-          std::cerr << "No C compiler found. Please declare AS." << std::endl;
-          return 1;
-        }
-        asm_comp = paths[0];
-      } else {
-        asm_comp = paths[0];
-      }
-    }
+  bool oneProject = projects.size() == 1;
+  if (isCustom && (customCommand[0] == "server" || customCommand[0] == "watch" || customCommand[0] == "pgo") && !oneProject) {
+    std::cerr << customCommand[0] << " builds one configuration, pick it with --config=name" << std::endl;
+    return 1;
   }
 
-  std::vector<std::string> paths;
-  recursiveSearch(SourceDir, paths);
-
-  for (const auto& path: paths) {
-    std::cout << "Compiling '" << path << "'" << std::endl;
-    std::string compile_command, flags;
-    int language;
-    std::string ext = path.substr(path.find_last_of('.'));
-    if (ext == ".cpp" || ext == ".c++") {
-      compile_command = cpp_comp;
-      flags = CF;
-    } else if (ext == ".asm" || ext == ".S") {
-      compile_command = asm_comp;
-      flags = CXXF;
-    } else if (ext == ".c") {
-      compile_command = c_comp;
-      flags = ASF;
+  if (isCustom && customCommand[0] == "explain") {
+    if (customCommand.size() != 2) {
+      std::cerr << "Usage: nmake explain <object or source file>" << std::endl;
+      return 1;
     }
+    return explain(projects, customCommand[1]);
+  }
 
-    std::string clean_out = path.substr(path.find_first_of(SourceDir)+SourceDir.size());
+  if (isCustom && customCommand[0] == "server")
+    return runServer(std::vector<std::string>(customCommand.begin() + 1, customCommand.end()), projects[0], config, configPath, argv);
 
-    compile_command += " -c " + path + " -o " + BuildDir + "/" + clean_out + ".o" + flags;
+  // watch runs the steps before every build it starts.
+  if (isCustom && customCommand[0] == "watch") return watch(projects[0], config, options, configPath, argv);
 
-    system(compile_command.c_str());
-    moveCursorAndClear(1);
-  }
-
-  std::string link_command = ld + " -o " + OutPath + " " + LDF;
-  for (const auto& path: paths) {
-    std::string clean_out = path.substr(path.find_first_of(SourceDir)+SourceDir.size());
-    link_command += BuildDir + "/" + clean_out + ".o ";
+  // Top level run lines and calls happen before the build.
+  if (!runSteps(config, options)) {
+    std::cerr << "Build failed." << std::endl;
+    return 1;
   }
 
-  std::cout << "Linking: " << link_command << std::endl;
-  system(link_command.c_str());
-  moveCursorAndClear(1);
-
-  std::cout << "Build completed successfully!" << std::endl;
+  if (isCustom && customCommand[0] == "pgo") return pgo(projects[0], config, options);
 
-  return 0;
+  if (oneProject) return build(projects[0], options);
+  return build(projects, options);
 }